@@ -18,6 +18,7 @@
 #include <led.h>
 #include "adaptertypes.h"
 #include "datacollector.h"
+#include "binarylink.h"
 
 
 using namespace std;
@@ -26,7 +27,8 @@ using namespace util;
 const int UART_SPEED = 115200;
 
 static CmdUart* glblUart;
-static DataCollector* collector;
+static DataCollector* volatile rxCollector; // filled by UART RX interrupt
+static DataCollector* cmdCollector;         // executed by the main loop
 
 /**
  * Enable the clocks and peripherals, initialize the drivers
@@ -41,6 +43,10 @@ static void SetAllRegisters()
     LPC_SYSCON->SYSAHBCLKCTRL1 |= (3 << 4);
     LPC_SYSCON->PRESETCTRL1 &= ~(3 << 4);
 
+    // Enable SCT1 for microsecond clock
+    LPC_SYSCON->SYSAHBCLKCTRL1 |= (1 << 3);
+    LPC_SYSCON->PRESETCTRL1 &= ~(1 << 3);
+
     // Enable RIT timer
     LPC_SYSCON->SYSAHBCLKCTRL1 |= (1 << 1);
     LPC_SYSCON->PRESETCTRL1 &= ~(1 << 1);
@@ -68,6 +74,11 @@ static bool UserUartRcvHandler(uint8_t ch)
 {
     bool ready = false;
     
+    if (BinaryLink::isActive()) { // no echo in binary mode
+        DataCollector* collector = rxCollector;
+        return collector->isComplete() ? false : BinaryLink::instance()->onRxByte(ch, collector);
+    }
+    
     if (AdapterConfig::instance()->getBoolProperty(PAR_ECHO) && ch != '\n') {
         glblUart->send(ch);
         if (ch == '\r' && AdapterConfig::instance()->getBoolProperty(PAR_LINEFEED)) {
@@ -75,7 +86,13 @@ static bool UserUartRcvHandler(uint8_t ch)
         }
     }
     
+    DataCollector* collector = rxCollector;
+    if (collector->isComplete()) { // the previous command is not taken yet
+        return false;
+    }
+    
     if (ch == '\r') { // Got cmd terminator
+        collector->complete();
         ready = true;
     }
     else if (isprint(ch)) { // this will skip '\n' as well
@@ -91,7 +108,12 @@ static bool UserUartRcvHandler(uint8_t ch)
  */
 void AdptSendString(const util::string& str)
 {
-    glblUart->send(str);
+    if (BinaryLink::isActive()) {
+        BinaryLink::instance()->sendText(str.c_str(), str.length());
+    }
+    else {
+        glblUart->send(str);
+    }
 }
 
 /**
@@ -99,8 +121,8 @@ void AdptSendString(const util::string& str)
  */
 static void AdapterRun() 
 {
-    collector = new DataCollector(RX_BUFFER_LEN, RX_RESERVED);
-    Ecumsg::setReferenceData(collector->getData());
+    rxCollector = new DataCollector(RX_BUFFER_LEN, RX_RESERVED);
+    cmdCollector = new DataCollector(RX_BUFFER_LEN, RX_RESERVED);
     
     glblUart = CmdUart::instance();
     glblUart->init(UART_SPEED);
@@ -110,9 +132,17 @@ static void AdapterRun()
     
     for(;;) {    
         if (glblUart->ready()) {
+            // Swap the collectors, the next command can arrive while this one executes
+            __disable_irq();
+            DataCollector* collector = rxCollector;
+            rxCollector = cmdCollector;
+            cmdCollector = collector;
             glblUart->ready(false);
-            AdptOnCmd(collector);
-            collector->reset();
+            __enable_irq();
+            
+            Ecumsg::setReferenceData(cmdCollector->getData());
+            AdptOnCmd(cmdCollector);
+            cmdCollector->reset();
         }
         else {
             AdptCheckHeartBeat();
@@ -1,15 +1,23 @@
 /**
  * See the file LICENSE for redistribution information.
  *
- * Copyright (c) 2009-2016 ObdDiag.Net. All rights reserved.
+ * Copyright (c) 2009-2018 ObdDiag.Net. All rights reserved.
  *
  */
 
 #include <cstring>
+#include <EepromDriver.h>
+#include <crc16.h>
 #include "adaptertypes.h"
 
 using namespace std;
+using namespace util;
+
 const uint64_t onebit = 1;
+const uint16_t CONFIG_MAGIC   = 0xC0F1;
+const uint8_t  CONFIG_VERSION = 1;
+const uint8_t  STORE_PARAMS   = 0x01; // PP FF ON, restore all the settings
+const uint8_t  STORE_MEMORY   = 0x02; // M1, restore the last protocol
 
 //
 // Configuration settings, storing/retrieving properties
@@ -74,3 +82,103 @@ void AdapterConfig::clear()
         ba.clear();
     }
 }
+
+/**
+ * Read the stored settings from EEPROM
+ * @param[out] stored The stored settings
+ * @return true if valid, false otherwise
+ */
+bool AdapterConfig::readStored(StoredConfig& stored) const
+{
+    uint8_t* data = reinterpret_cast<uint8_t*>(&stored);
+    if (!EepromDriver::read(EEPROM_CONFIG_ADDR, data, sizeof(StoredConfig)))
+        return false;
+    return stored.magic == CONFIG_MAGIC && stored.version == CONFIG_VERSION &&
+           stored.length == sizeof(StoredConfig) && stored.boolNum == BYTE_PROPS_END &&
+           stored.crc == crc16(data, sizeof(StoredConfig) - sizeof(stored.crc));
+}
+
+/**
+ * Write the settings to EEPROM
+ * @param[in] stored The settings to store
+ */
+void AdapterConfig::writeStored(StoredConfig& stored) const
+{
+    uint8_t* data = reinterpret_cast<uint8_t*>(&stored);
+    stored.magic = CONFIG_MAGIC;
+    stored.version = CONFIG_VERSION;
+    stored.length = sizeof(StoredConfig);
+    stored.boolNum = BYTE_PROPS_END;
+    stored.crc = crc16(data, sizeof(StoredConfig) - sizeof(stored.crc));
+    EepromDriver::write(EEPROM_CONFIG_ADDR, data, sizeof(StoredConfig));
+}
+
+/**
+ * Store the current settings to apply on reset, "ATPPFFON", or disable them, "ATPPFFOFF".
+ * The protocol and the binary mode are not restored from the snapshot
+ * @param[in] enable The flag
+ */
+void AdapterConfig::storeParams(bool enable)
+{
+    StoredConfig stored = {};
+    if (!readStored(stored)) {
+        stored = StoredConfig();
+    }
+    if (enable) {
+        stored.flags |= STORE_PARAMS;
+        stored.values = values_;
+        memcpy(stored.intProps, intProps_, sizeof(intProps_));
+        for (int i = 0; i < BYTES_PROP_LEN; i++) {
+            stored.bytesProps[i] = bytesProps_[i];
+        }
+    }
+    else {
+        stored.flags &= ~STORE_PARAMS;
+    }
+    writeStored(stored);
+}
+
+/**
+ * Store the protocol to use on reset, "ATM1"
+ * @param[in] memory The memory flag
+ * @param[in] protocol The protocol
+ */
+void AdapterConfig::storeProtocol(bool memory, uint32_t protocol)
+{
+    StoredConfig stored = {};
+    if (!readStored(stored)) {
+        stored = StoredConfig();
+    }
+    uint8_t flags = memory ? (stored.flags | STORE_MEMORY) : (stored.flags & ~STORE_MEMORY);
+    if (flags == stored.flags && stored.protocol == protocol)
+        return; // Spare EEPROM
+    stored.flags = flags;
+    stored.protocol = protocol;
+    writeStored(stored);
+}
+
+/**
+ * Apply the stored settings, if any, on top of defaults
+ */
+void AdapterConfig::restore()
+{
+    StoredConfig stored;
+    if (!readStored(stored))
+        return;
+    if (stored.flags & STORE_PARAMS) {
+        // The protocol is driven by ATM1 only, the binary mode is per session
+        uint32_t protocol = getIntProperty(PAR_PROTOCOL);
+        bool binaryMode = getBoolProperty(PAR_BINARY_MODE);
+        values_ = stored.values;
+        memcpy(intProps_, stored.intProps, sizeof(intProps_));
+        for (int i = 0; i < BYTES_PROP_LEN; i++) {
+            bytesProps_[i] = stored.bytesProps[i];
+        }
+        setIntProperty(PAR_PROTOCOL, protocol);
+        setBoolProperty(PAR_BINARY_MODE, binaryMode);
+    }
+    setBoolProperty(PAR_MEMORY, stored.flags & STORE_MEMORY);
+    if (stored.flags & STORE_MEMORY) {
+        setIntProperty(PAR_PROTOCOL, stored.protocol);
+    }
+}
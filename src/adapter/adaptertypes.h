@@ -28,10 +28,19 @@ const int OBD_OUT_MSG_LEN  = OBD_OUT_MSG_DLEN + KWP_EXTRA_LEN;
 const int J1850_IN_MSG_DLEN = 2080;
 const int J1850_EXTRA_LEN   = 4; // 3 header + 1 chksum
 
+// ISO 15765-2 part
+const int ISOTP_MAX_DLEN    = 4095;
+
 const int TX_BUFFER_LEN  = 64;
-const int RX_BUFFER_LEN  = J1850_IN_MSG_DLEN;
+const int CMD_LINE_LEN   = 128; // command line chars kept by collector
+const int RX_BUFFER_LEN  = ISOTP_MAX_DLEN;
 const int RX_RESERVED    = J1850_EXTRA_LEN;
 
+// EEPROM layout
+const uint32_t EEPROM_PROTOCOL_ADDR = 0x000; // auto detection statistics
+const uint32_t EEPROM_CONFIG_ADDR   = 0x040; // stored settings, ATPPFFON/ATM1
+const uint32_t EEPROM_P4_CACHE_ADDR = 0x100; // calibrated K-line P4 times
+
 //
 // Command dispatch values
 //
@@ -46,12 +55,15 @@ enum AT_Requests {
     PAR_ADPTV_TIM2,
     PAR_ALLOW_LONG,
     PAR_AUTO_RECEIVE,
+    PAR_BATCH_REQUEST,
+    PAR_BINARY_MODE,
     PAR_BUFFER_DUMP,
     PAR_BYPASS_INIT,
     PAR_CALIBRATE_VOLT,
     PAR_CAN_CAF,
     PAR_CAN_DLC,
     PAR_CAN_FLOW_CONTROL,
+    PAR_CAN_REASSEMBLE,
     PAR_CAN_SEND_RTR,
     PAR_CAN_SHOW_STATUS,
     PAR_CAN_SILENT_MODE,
@@ -68,17 +80,20 @@ enum AT_Requests {
     PAR_HEADER_SHOW,
     PAR_INFO,
     PAR_INFRAME_RESPONSE,
-    PAR_ISO_BAUDRATE,
     PAR_J1939_DM1_MONITOR,
     PAR_J1939_FMT,
     PAR_J1939_HEADER,
     PAR_J1939_MONITOR,
     PAR_J1939_TIMEOUT_MLT,
+    PAR_KLINE_TUNE,
+    PAR_KWP_TIMING,
     PAR_KW_CHECK,
     PAR_KW_DISPLAY,
     PAR_LINEFEED,
     PAR_LOW_POWER_MODE,
     PAR_MEMORY,
+    PAR_MONITOR,
+    PAR_POLL_SCHEDULE,
     PAR_PROTOCOL_CLOSE,
     PAR_READ_VOLT,
     PAR_RESET_CPU,
@@ -98,7 +113,9 @@ enum AT_Requests {
     PAR_CAN_FLOW_CTRL_MD,
     PAR_CAN_SET_ADDRESS,
     PAR_CAN_TSTR_ADDRESS,
+    PAR_ISO_BAUDRATE,
     PAR_ISO_INIT_ADDRESS,
+    PAR_KWP_SPEED,
     PAR_PROTOCOL,
     PAR_RECEIVE_ADDRESS,
     PAR_RECEIVE_FILTER,
@@ -178,9 +195,28 @@ public:
     void     setBytesProperty(int parameter, const ByteArray* bytes);
     const    ByteArray* getBytesProperty(int parameter) const;
     void clear();
+    void storeParams(bool enable);
+    void storeProtocol(bool memory, uint32_t protocol);
+    void restore();
 private:
     const static int INT_PROP_LEN   = INT_PROPS_END - INT_PROPS_START;
     const static int BYTES_PROP_LEN = BYTES_PROPS_END - BYTES_PROPS_START;
+    
+    // The settings stored in EEPROM
+    struct StoredConfig {
+        uint16_t   magic;
+        uint16_t   length;  // the layout changes with the properties
+        uint8_t    version;
+        uint8_t    flags;
+        uint8_t    protocol;
+        uint8_t    boolNum; // the bool ids change with the properties
+        uint64_t   values;
+        uint32_t   intProps  [INT_PROP_LEN];
+        ByteArray  bytesProps[BYTES_PROP_LEN];
+        uint16_t   crc;
+    };
+    bool readStored(StoredConfig& stored) const;
+    void writeStored(StoredConfig& stored) const;
 
     AdapterConfig();
     uint64_t   values_; // 64 max
@@ -210,6 +246,7 @@ void AdptSendReply(const char* str);
 void AdptSendReply(const util::string& str);
 void AdptSendReply(util::string& str);
 void AdptDispatcherInit();
+int  AdptResolveCmd(const util::string& cmdString, uint32_t& argPos);
 void AdptOnCmd(const DataCollector* collector);
 void AdptCheckHeartBeat();
 void AdptReadSerialNum();
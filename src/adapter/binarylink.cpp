@@ -0,0 +1,316 @@
+/**
+ * See the file LICENSE for redistribution information.
+ *
+ * Copyright (c) 2009-2018 ObdDiag.Net. All rights reserved.
+ *
+ */
+
+#include <cstring>
+#include <crc16.h>
+#include <CmdUart.h>
+#include <Timer.h>
+#include "adaptertypes.h"
+#include "datacollector.h"
+#include "canmsgbuffer.h"
+#include "obd/obdprofile.h"
+#include "binarylink.h"
+
+using namespace std;
+using namespace util;
+
+const uint32_t MaxTextLen = 255;
+
+/**
+ * Constructor
+ */
+BinaryLink::BinaryLink()
+  : uart_(CmdUart::instance()),
+    active_(false),
+    state_(RX_SYNC),
+    type_(0),
+    length_(0),
+    pos_(0),
+    numOfResp_(0),
+    crc_(0),
+    rxCrc_(0),
+    txCrc_(0),
+    rxTime_(0),
+    rawLen_(0)
+{
+}
+
+/**
+ * BinaryLink singleton
+ */
+BinaryLink* BinaryLink::instance()
+{
+    static BinaryLink instance;
+    return &instance;
+}
+
+/**
+ * Binary mode is enabled, "ATBM1". The mode holds for the whole command,
+ * the replies and the status of "ATBM0" or "ATZ" are still binary
+ */
+bool BinaryLink::isActive()
+{
+    return instance()->active_;
+}
+
+/**
+ * Apply the binary mode setting, called between the commands
+ */
+void BinaryLink::update()
+{
+    active_ = AdapterConfig::instance()->getBoolProperty(PAR_BINARY_MODE);
+}
+
+/**
+ * The gap between the frame bytes which resets the parser, 8 byte times
+ * at the host speed but not less than 2ms to tolerate USB bridges
+ * @return The timeout, us
+ */
+uint32_t BinaryLink::byteTimeout() const
+{
+    const uint32_t MinTimeout = 2000;
+    uint32_t timeout = 8 * 10 * 1000000 / uart_->speed();
+    return timeout > MinTimeout ? timeout : MinTimeout;
+}
+
+/**
+ * Receive the request frame byte, called from UART RX interrupt. The payload
+ * goes straight into the collector, the collector is discarded on error
+ * @param[in] byte The received byte
+ * @param[in] collector The collector to fill
+ * @return true if the request is complete
+ */
+bool BinaryLink::onRxByte(uint8_t byte, DataCollector* collector)
+{
+    uint32_t now = MicroTimer::instance()->value();
+    if (state_ != RX_SYNC && (now - rxTime_) > byteTimeout()) {
+        state_ = RX_SYNC; // the rest of the frame is lost, hunt for the next one
+        collector->reset();
+    }
+    rxTime_ = now;
+    
+    if (state_ == RX_SYNC) {
+        rawLen_ = 0;
+    }
+    // Keep the frame start, the byte count goes on past the window
+    if (rawLen_ < RX_RAW_LEN) {
+        raw_[rawLen_] = byte;
+    }
+    rawLen_++;
+    
+    switch (parse(byte, collector)) {
+        case RX_DONE:
+            return true;
+        case RX_BAD:
+            return rescan(collector);
+        default:
+            return false;
+    }
+}
+
+/**
+ * Rescan the bad frame from the byte after its SYNC, the bytes are
+ * replayed only if the whole frame is kept
+ * @param[in] collector The collector to fill
+ * @return true if the request is complete
+ */
+bool BinaryLink::rescan(DataCollector* collector)
+{
+    state_ = RX_SYNC;
+    collector->reset();
+    if (rawLen_ > RX_RAW_LEN) {
+        rawLen_ = 0;
+        return false;
+    }
+    
+    while (rawLen_ > 1) {
+        uint32_t start = 1;
+        while (start < rawLen_ && raw_[start] != SYNC) {
+            start++;
+        }
+        rawLen_ -= start;
+        memmove(raw_, raw_ + start, rawLen_);
+        
+        RxResult sts = RX_MORE;
+        uint32_t i = 0;
+        while (i < rawLen_ && sts == RX_MORE) {
+            sts = parse(raw_[i++], collector);
+        }
+        if (sts == RX_BAD) {
+            state_ = RX_SYNC;
+            collector->reset();
+            continue;
+        }
+        if (sts == RX_DONE) { // the bytes behind the frame are dropped
+            rawLen_ = 0;
+            return true;
+        }
+        return false; // the frame continues with the next bytes received
+    }
+    rawLen_ = 0;
+    return false;
+}
+
+/**
+ * Parse the request frame byte
+ * @param[in] byte The received byte
+ * @param[in] collector The collector to fill
+ * @return RX_DONE if the request is complete, RX_BAD on error, RX_MORE otherwise
+ */
+BinaryLink::RxResult BinaryLink::parse(uint8_t byte, DataCollector* collector)
+{
+    switch (state_) {
+        case RX_SYNC:
+            if (byte == SYNC) {
+                crc_ = CRC16_INIT;
+                state_ = RX_LEN_LO;
+            }
+            return RX_MORE;
+        case RX_LEN_LO:
+            length_ = byte;
+            state_ = RX_LEN_HI;
+            break;
+        case RX_LEN_HI:
+            length_ |= byte << 8;
+            state_ = RX_TYPE;
+            break;
+        case RX_TYPE:
+            type_ = byte;
+            pos_ = 0;
+            numOfResp_ = 0;
+            if ((type_ == REQ_OBD && length_ > 0 && length_ <= (RX_BUFFER_LEN + 1)) ||
+                (type_ == REQ_TEXT && length_ <= MaxTextLen)) {
+                collector->reset();
+                state_ = length_ ? RX_PAYLOAD : RX_CRC_LO;
+            }
+            else {
+                return RX_BAD;
+            }
+            break;
+        case RX_PAYLOAD:
+            if (type_ == REQ_TEXT) {
+                collector->putChar(byte);
+            }
+            else if (pos_ > 0) { // the first byte is the number of responses
+                collector->putByte(byte);
+            }
+            else {
+                numOfResp_ = byte; // keep it until the frame is complete
+            }
+            if (++pos_ == length_) {
+                state_ = RX_CRC_LO;
+            }
+            break;
+        case RX_CRC_LO:
+            rxCrc_ = byte;
+            state_ = RX_CRC_HI;
+            return RX_MORE;
+        case RX_CRC_HI:
+            state_ = RX_SYNC;
+            rxCrc_ |= byte << 8;
+            if (rxCrc_ != crc_) {
+                return RX_BAD;
+            }
+            collector->complete();
+            if (numOfResp_) {
+                collector->setNumOfResponses(numOfResp_);
+            }
+            return RX_DONE;
+    }
+    crc_ = crc16(byte, crc_);
+    return RX_MORE;
+}
+
+/**
+ * Write one byte and update the frame CRC
+ * @param[in] byte The byte to write
+ */
+void BinaryLink::put(uint8_t byte)
+{
+    txCrc_ = crc16(byte, txCrc_);
+    uart_->put(byte);
+}
+
+/**
+ * Write the frame straight into UART TX ring
+ * @param[in] type The frame type
+ * @param[in] hdr The payload header bytes
+ * @param[in] hdrLen The payload header length
+ * @param[in] data The payload data bytes
+ * @param[in] length The payload data length
+ */
+void BinaryLink::sendFrame(uint8_t type, const uint8_t* hdr, uint32_t hdrLen, const uint8_t* data, uint32_t length)
+{
+    uint32_t len = hdrLen + length;
+    
+    uart_->put(SYNC);
+    txCrc_ = CRC16_INIT;
+    put(len & 0xFF);
+    put(len >> 8);
+    put(type);
+    for (uint32_t i = 0; i < hdrLen; i++) {
+        put(hdr[i]);
+    }
+    for (uint32_t i = 0; i < length; i++) {
+        put(data[i]);
+    }
+    uint16_t crc = txCrc_;
+    uart_->put(crc & 0xFF);
+    uart_->put(crc >> 8);
+    uart_->commit();
+}
+
+/**
+ * Send the CAN frame as message
+ * @param[in] msg CanMsgbuffer instance pointer
+ */
+void BinaryLink::sendMessage(const CanMsgBuffer* msg)
+{
+    sendMessage(msg->id, msg->extended, msg->data, msg->dlc);
+}
+
+/**
+ * Send the message
+ * @param[in] id The message ID or header bytes
+ * @param[in] extended 29 bit CAN ID flag
+ * @param[in] data The message data bytes
+ * @param[in] length The message data length
+ * @param[in] flags The extra message flags
+ */
+void BinaryLink::sendMessage(uint32_t id, bool extended, const uint8_t* data, uint32_t length, uint8_t flags)
+{
+    uint8_t hdr[] = {
+        static_cast<uint8_t>(OBDProfile::instance()->getProtocol()),
+        static_cast<uint8_t>((extended ? MSG_FLAG_EXTENDED : 0) | flags),
+        static_cast<uint8_t>(id),
+        static_cast<uint8_t>(id >> 8),
+        static_cast<uint8_t>(id >> 16),
+        static_cast<uint8_t>(id >> 24),
+        static_cast<uint8_t>(length > 0xFF ? 0xFF : length)
+    };
+    sendFrame(RPL_MSG, hdr, sizeof(hdr), data, length);
+}
+
+/**
+ * Send the text line
+ * @param[in] str The text
+ * @param[in] length The text length
+ */
+void BinaryLink::sendText(const char* str, uint32_t length)
+{
+    sendFrame(RPL_TEXT, 0, 0, reinterpret_cast<const uint8_t*>(str), length);
+}
+
+/**
+ * Send the request status, the last frame for every request
+ * @param[in] status ReplyTypes status
+ */
+void BinaryLink::sendStatus(int status)
+{
+    uint8_t sts = status;
+    sendFrame(RPL_STATUS, &sts, 1, 0, 0);
+}
@@ -0,0 +1,86 @@
+/**
+ * See the file LICENSE for redistribution information.
+ *
+ * Copyright (c) 2009-2018 ObdDiag.Net. All rights reserved.
+ *
+ */
+
+#ifndef __BINARY_LINK_H__
+#define __BINARY_LINK_H__
+
+#include <cstdint>
+
+using namespace std;
+
+class DataCollector;
+class CmdUart;
+struct CanMsgBuffer;
+
+//
+// Binary host protocol, "ATBM1" to enable, the frame layout is
+// SYNC LEN(2 bytes, LE) TYPE PAYLOAD[LEN] CRC(2 bytes, LE),
+// CRC-16/CCITT over LEN, TYPE and PAYLOAD
+//
+class BinaryLink {
+public:
+    const static uint8_t SYNC       = 0xA5;
+    
+    // Host requests
+    const static uint8_t REQ_OBD    = 0x01; // [numOfResp] [data...]
+    const static uint8_t REQ_TEXT   = 0x02; // AT command without <CR>
+    
+    // Adapter replies
+    const static uint8_t RPL_MSG    = 0x81; // [protocol] [flags] [id, 4 bytes LE] [dlc] [data...]
+    const static uint8_t RPL_TEXT   = 0x82; // Text line without <CR><LF>
+    const static uint8_t RPL_STATUS = 0x83; // [ReplyTypes status], ends every request
+    
+    const static uint8_t MSG_FLAG_EXTENDED = 0x01;
+    const static uint8_t MSG_FLAG_PAYLOAD  = 0x02; // reassembled ISO-TP payload, not a frame
+    
+    static BinaryLink* instance();
+    static bool isActive();
+    void update();
+    bool onRxByte(uint8_t byte, DataCollector* collector);
+    void sendMessage(const CanMsgBuffer* msg);
+    void sendMessage(uint32_t id, bool extended, const uint8_t* data, uint32_t length, uint8_t flags = 0);
+    void sendText(const char* str, uint32_t length);
+    void sendStatus(int status);
+private:
+    enum RxResult {
+        RX_MORE,
+        RX_DONE,
+        RX_BAD
+    };
+    enum RxState {
+        RX_SYNC,
+        RX_LEN_LO,
+        RX_LEN_HI,
+        RX_TYPE,
+        RX_PAYLOAD,
+        RX_CRC_LO,
+        RX_CRC_HI
+    };
+    const static uint32_t RX_RAW_LEN = 128; // the frame bytes kept for rescan
+    BinaryLink();
+    RxResult parse(uint8_t byte, DataCollector* collector);
+    bool rescan(DataCollector* collector);
+    uint32_t byteTimeout() const;
+    void sendFrame(uint8_t type, const uint8_t* hdr, uint32_t hdrLen, const uint8_t* data, uint32_t length);
+    void put(uint8_t byte);
+    
+    CmdUart* uart_;
+    bool     active_; // the mode of the command in progress
+    RxState  state_;
+    uint8_t  type_;
+    uint16_t length_;
+    uint16_t pos_;
+    uint8_t  numOfResp_;
+    uint16_t crc_;
+    uint16_t rxCrc_;
+    uint16_t txCrc_;
+    uint32_t rxTime_;
+    uint32_t rawLen_;
+    uint8_t  raw_[RX_RAW_LEN];
+};
+
+#endif //__BINARY_LINK_H__
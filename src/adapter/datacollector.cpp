@@ -8,8 +8,8 @@
 #include <climits>
 #include <cctype>
 #include <memory>
-#include <cstdlib>
 #include <algorithms.h>
+#include <hexcodec.h>
 #include "adaptertypes.h"
 #include "datacollector.h"
 
@@ -17,13 +17,18 @@
 using namespace std;
 using namespace util;
 
-const int CollectorStrLen = 16;
+const uint32_t NumOfResp = 0xFFFFFFFF;
 
 DataCollector::DataCollector(uint32_t size, uint32_t reserved) 
-  : str_(CollectorStrLen), 
+  : str_(CMD_LINE_LEN), 
     length_(0), 
+    numOfResp_(NumOfResp),
+    argPos_(0),
+    cmdIndex_(-1),
     previous_(0), 
-    binary_(true)
+    nibble_(0),
+    binary_(true),
+    complete_(false)
 {
     data_ = new uint8_t[size + reserved]; // Heap alocation
     limit_ = size;
@@ -35,60 +40,97 @@ DataCollector& DataCollector::operator=(const DataCollector& collector)
     if (this != &collector) {
         str_ = collector.str_;
         length_ = util::min(collector.length_, limit_);
+        numOfResp_ = collector.numOfResp_;
+        argPos_ = collector.argPos_;
+        cmdIndex_ = collector.cmdIndex_;
         previous_ = collector.previous_;
+        nibble_ = collector.nibble_;
         binary_ = collector.binary_;
+        complete_ = collector.complete_;
         memcpy(data_, collector.data_, length_);
     }
     return *this;
 }
 
+/**
+ * Add the next command character, called from UART RX interrupt,
+ * the hex pairs are decoded on the fly
+ * @param[in] ch The character
+ */
 void DataCollector::putChar(char ch)
 {
     if (ch == ' ' || ch == 0 ) // Ignore spaces
         return;
     
     // Make it uppercase
-    ch = toupper(ch);
-    binary_ = binary_ ? isxdigit(ch) : false;
+    if (ch >= 'a' && ch <= 'z') {
+        ch -= 'a' - 'A';
+    }
+
+    int nibble = hex_value(ch);
+    if (nibble < 0) {
+        binary_ = false;
+        nibble = 0;
+    }
     
-    if (str_.length() < CollectorStrLen) {
+    if (str_.length() < CMD_LINE_LEN) {
         str_ += ch;
     }
     if (length_ < limit_) { // If more then BINARY_DATA_LEN, ignore
         if (binary_ && previous_) {
-            char twoChars[] = { previous_, ch, 0 }; 
-            data_[length_++] = strtoul(twoChars, 0, 16);
+            data_[length_++] = (nibble_ << 4) | nibble;
             previous_ = 0;
         }
         else {
             previous_ = ch; // save for the next ops
+            nibble_ = nibble;
         }
     }
 }
 
+/**
+ * Add the next binary request byte, called from UART RX interrupt,
+ * keep the hex representation for the short requests
+ * @param[in] byte The byte
+ */
+void DataCollector::putByte(uint8_t byte)
+{
+    if (str_.length() + 2 <= CMD_LINE_LEN) {
+        uint16_t pair = HexEncodeTable[byte];
+        str_ += static_cast<char>(pair & 0xFF);
+        str_ += static_cast<char>(pair >> 8);
+    }
+    if (length_ < limit_) {
+        data_[length_++] = byte;
+    }
+}
+
+/**
+ * The command terminator received, resolve the number of responses
+ * and the AT command entry, called from UART RX interrupt
+ */
+void DataCollector::complete()
+{
+    numOfResp_ = NumOfResp;
+    if (binary_ && previous_ != 0 && !isHugeBuffer() && nibble_ > 0) {
+        numOfResp_ = nibble_;
+    }
+    cmdIndex_ = binary_ ? -1 : AdptResolveCmd(str_, argPos_);
+    complete_ = true;
+}
+
 void DataCollector::reset()
 {
     str_.clear();
-    length_   = 0;
-    previous_ = 0;
-    binary_   = true;
+    length_    = 0;
+    numOfResp_ = NumOfResp;
+    cmdIndex_  = -1;
+    previous_  = 0;
+    binary_    = true;
+    complete_  = false;
 }
 
 bool DataCollector::isHugeBuffer() const
 {
     return length_ > OBD_IN_MSG_DLEN;
 }
-    
-uint32_t DataCollector::getNumOfResponses() const
-{    
-    const uint32_t NumOfResp = 0xFFFFFFFF;
-    
-    if (previous_ != 0 && !isHugeBuffer()) {
-        char twoChars[] = { previous_, 0 }; 
-        uint32_t value  = strtoul(twoChars, 0, 16);
-        return (value > 0) ? value : NumOfResp;
-    }
-    else {
-        return NumOfResp;
-    }
-}
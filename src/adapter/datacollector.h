@@ -17,10 +17,16 @@ public:
     const util::string& getString() const {return str_; }
     const uint8_t* getData() const { return data_; }
     uint32_t getLength() const { return length_; }
-    uint32_t getNumOfResponses() const;
+    uint32_t getNumOfResponses() const { return numOfResp_; }
+    int getCmdIndex() const { return cmdIndex_; }
+    uint32_t getArgPos() const { return argPos_; }
     bool isData() const { return binary_; }
     bool isHugeBuffer() const;
+    bool isComplete() const { return complete_; }
     void putChar(char ch);
+    void putByte(uint8_t byte);
+    void setNumOfResponses(uint32_t val) { numOfResp_ = val; }
+    void complete();
     void reset();
     
 private:
@@ -28,8 +34,13 @@ private:
     util::string str_;
     uint8_t* data_;
     uint32_t length_;
+    uint32_t numOfResp_;
+    uint32_t argPos_;
+    int cmdIndex_;
     char previous_;
+    uint8_t nibble_;
     bool binary_;
+    bool complete_;
 };
 
 #endif //__DATACOLLECTOR_H__
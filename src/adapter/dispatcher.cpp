@@ -7,13 +7,19 @@
 
 #include <climits>
 #include <cstdio>
+#include <cstring>
 #include "adaptertypes.h"
 #include "datacollector.h"
+#include "replywriter.h"
+#include "binarylink.h"
+#include "pollscheduler.h"
 #include <obd/j1979.h>
 #include "obd/obdprofile.h"
 #include <algorithms.h>
 #include <CmdUart.h>
+#include <Timer.h>
 #include <AdcDriver.h>
+#include <CanDriver.h>
 #include <timeoutmgr.h>
 #include <obd/isocan.h>
 
@@ -157,6 +163,14 @@ static void OnSetAT2(const string& cmd, int par)
  */
 static void OnCanShowStatus(const string& cmd, int par)
 {
+    CanDriver* driver = CanDriver::instance();
+    uint32_t errors = driver->getErrorCounters();
+    char out[32];
+
+    sprintf(out, "T:%02X R:%02X", errors & 0xFF, (errors >> 8) & 0x7F);
+    AdptSendReply(out);
+    sprintf(out, "OVF:%lu", driver->getOverflows());
+    AdptSendReply(out);
 }
 
 /**
@@ -325,8 +339,115 @@ static void OnSendReplyInterface(const string& cmd, int par)
     AdptSendReply(Interface);
 }
 
+/**
+ * Try the new host baud rate, "ATBRD hh", the rate is 4000000/hh.
+ * Switch the speed, send ID string and wait for CR within ATBRT window,
+ * revert to the previous speed if CR has not been received
+ * @param[in] cmd Command line
+ * @param[in] par The number in dispatch table, ignored
+ */
+static void OnTryBaudRate(const string& cmd, int par)
+{
+    const uint32_t BaudRateBase = 4000000;
+    const uint32_t DefaultBrt = 0x0F;  // 75ms
+    const uint32_t BrtUnit = 5;        // 5ms
+
+    uint32_t val = stoul(cmd, 0, 16);
+    if (val == ULONG_MAX || val < 2) { // 2 Mbit/s max
+        AdptSendReply(ErrMessage);
+        return;
+    }
+
+    CmdUart* uart = CmdUart::instance();
+    uint32_t prevSpeed = uart->speed();
+    uint32_t brt = AdapterConfig::instance()->getIntProperty(PAR_SET_BRD);
+    if (brt == 0) {
+        brt = DefaultBrt;
+    }
+
+    AdptSendReply(OkMessage);
+    uart->flush();
+    uart->capture(true);
+    uart->setSpeed(BaudRateBase / val);
+    AdptSendString(Interface);
+    AdptSendString("\r");
+    uart->flush();
+
+    bool confirmed = false;
+    uint8_t ch;
+    Timer* timer = Timer::instance(0);
+    timer->start(brt * BrtUnit);
+    while (!timer->isExpired()) {
+        if (uart->captured(ch) && ch == '\r') {
+            confirmed = true;
+            break;
+        }
+    }
+
+    if (!confirmed) {
+        uart->setSpeed(prevSpeed);
+    }
+    uart->capture(false);
+
+    if (confirmed) {
+        AdptSendReply(OkMessage);
+    }
+}
+
+/**
+ * Get the K-line baud rate by ATIB/ATKS code
+ * @param[in] code The 2 digit code
+ * @return The baud rate, 0 if not valid
+ */
+static uint32_t IsoBaudRate(const string& code)
+{
+    static const struct {
+        const char* code;
+        uint32_t    speed;
+    } Rates[] = {
+        { "10", 10400 }, { "48", 4800 }, { "96", 9600 },
+        { "19", 19200 }, { "38", 38400 }, { "57", 57600 }
+    };
+    for (const auto& rate : Rates) {
+        if (code == rate.code)
+            return rate.speed;
+    }
+    return 0;
+}
+
+/**
+ * Set ISO 9141/14230 baud rate, "ATIB 10/48/96"
+ * @param[in] cmd Command line
+ * @param[in] par The number in dispatch table
+ */
 static void OnSetIsoBaudRate(const string& cmd, int par)
 {
+    uint32_t speed = IsoBaudRate(cmd);
+    if (speed == 10400 || speed == 4800 || speed == 9600) {
+        AdapterConfig::instance()->setIntProperty(par, speed);
+        AdptSendReply(OkMessage);
+    }
+    else {
+        AdptSendReply(ErrMessage);
+    }
+}
+
+/**
+ * Set KWP2000 high speed baud rate, switched to after the positive
+ * StartDiagnosticSession response, "ATKS 19/38/57", "ATKS 00" to disable
+ * @param[in] cmd Command line
+ * @param[in] par The number in dispatch table
+ */
+static void OnSetKwpSpeed(const string& cmd, int par)
+{
+    uint32_t speed = IsoBaudRate(cmd);
+    if (speed || cmd == "00") {
+        AdapterConfig::instance()->setIntProperty(par, speed);
+        AdptSendReply(OkMessage);
+    }
+    else {
+        AdptSendReply(ErrMessage);
+    }
 }
 
 /**
@@ -359,6 +480,56 @@ static void OnJ1939MonitorMP(const string& cmd, int par)
     OBDProfile::instance()->monitor(cmd);
 }
 
+/**
+ * Execute CAN bus monitor, "ATMA", "ATMR hh" and "ATMT hh"
+ * @param[in] cmd Command line
+ * @param[in] mode The monitor mode
+ */
+static void OnBusMonitor(const string& cmd, int mode)
+{
+    uint32_t addr = 0;
+    if (mode != MONITOR_ALL) {
+        addr = stoul(cmd, 0, 16);
+        if (addr == ULONG_MAX) {
+            AdptSendReply(ErrMessage);
+            return;
+        }
+    }
+    if (OBDProfile::instance()->busMonitor(mode, addr) != REPLY_OK) {
+        AdptSendReply(ErrMessage);
+    }
+}
+
+/**
+ * Execute ATMA monitor
+ * @param[in] cmd Command line, ignored
+ * @param[in] par The number in dispatch table, ignored
+ */
+static void OnMonitorAll(const string& cmd, int par)
+{
+    OnBusMonitor(cmd, MONITOR_ALL);
+}
+
+/**
+ * Execute ATMR monitor
+ * @param[in] cmd Command line
+ * @param[in] par The number in dispatch table, ignored
+ */
+static void OnMonitorReceiver(const string& cmd, int par)
+{
+    OnBusMonitor(cmd, MONITOR_RECEIVER);
+}
+
+/**
+ * Execute ATMT monitor
+ * @param[in] cmd Command line
+ * @param[in] par The number in dispatch table, ignored
+ */
+static void OnMonitorTransmitter(const string& cmd, int par)
+{
+    OnBusMonitor(cmd, MONITOR_TRANSMITTER);
+}
+
 /**
  * Set the receive address to XX
  * @param[in] cmd Command line, ignored
@@ -433,6 +604,9 @@ static void OnSetProtocol(const string& cmd, int par)
     AdapterConfig::instance()->setBoolProperty(PAR_USE_AUTO_SP, useAutoSP);
     if (OBDProfile::instance()->setProtocol(protocol, true) == REPLY_OK) {
         AdapterConfig::instance()->setIntProperty(PAR_PROTOCOL, protocol);
+        if (AdapterConfig::instance()->getBoolProperty(PAR_MEMORY)) {
+            AdapterConfig::instance()->storeProtocol(true, protocol);
+        }
     AdptSendReply(OkMessage);
 }
     else {
@@ -441,6 +615,40 @@ static void OnSetProtocol(const string& cmd, int par)
     }
 }
 
+/**
+ * Store the header bytes, 3/6 digits as "ATSH xyz" or "ATSH xx yy zz",
+ * 8 digits as "ATSH ww xx yy zz" with CAN priority bits
+ * @param[in] hdr The header digits
+ * @return true if the header stored, false otherwise
+ */
+static bool SetHeader(const string& hdr)
+{
+    AdapterConfig* config = AdapterConfig::instance();
+    ByteArray cpBytes, hdrBytes;
+    uint32_t len = hdr.length();
+
+    if (len == 3 || len == 6) {
+        string hdrData = (len == 3) ? "0" + hdr : hdr; //1.5 bytes
+        if (!to_bytes(hdrData, hdrBytes.data))
+            return false;
+        hdrBytes.length = hdrData.length() / 2;
+        config->setBytesProperty(PAR_HEADER_BYTES, &hdrBytes);
+        return true;
+    }
+    if (len != 8)
+        return false;
+
+    string cp = hdr.substr(0, 2);
+    string hdr4 = hdr.substr(2);
+    if (!to_bytes(cp, cpBytes.data) || !to_bytes(hdr4, hdrBytes.data))
+        return false;
+    cpBytes.length = cp.length() / 2;
+    config->setBytesProperty(PAR_CAN_PRIORITY_BITS, &cpBytes);
+    hdrBytes.length = hdr4.length() / 2;
+    config->setBytesProperty(PAR_HEADER_BYTES, &hdrBytes);
+    return true;
+}
+
 /**
  * Set 4 header bytes for CAN 29, "ATSH ww xx yy zz"
  * @param[in] cmd Command line
@@ -448,20 +656,70 @@ static void OnSetProtocol(const string& cmd, int par)
  */
 static void OnSet4HeaderBytes(const string& cmd, int par)
 {
-    ByteArray cpBytes, hdrBytes;
-    
-    string cp = cmd.substr(0, 2);
-    string hdr = cmd.substr(2);
-    
-    if (!to_bytes(cp, cpBytes.data) || !to_bytes(hdr, hdrBytes.data)) {
-        AdptSendReply(ErrMessage);
-        return;
+    AdptSendReply(SetHeader(cmd) ? OkMessage : ErrMessage);
+}
+
+/**
+ * Run the batch of OBD requests, "ATBQ [hdr:]data[n],[hdr:]data[n],..."
+ * all the replies are sent before the single prompt, the item header
+ * applies to that item only
+ * @param[in] cmd Command line
+ * @param[in] par The number in dispatch table, ignored
+ */
+static void OnBatchRequest(const string& cmd, int par)
+{
+    static DataCollector batchCollector(CMD_LINE_LEN / 2);
+    AdapterConfig* config = AdapterConfig::instance();
+    const bool binaryMode = BinaryLink::isActive();
+
+    // Keep the session header, restored after the batch
+    const ByteArray hdrBytes = *config->getBytesProperty(PAR_HEADER_BYTES);
+    const ByteArray cpBytes = *config->getBytesProperty(PAR_CAN_PRIORITY_BITS);
+
+    const uint32_t len = cmd.length();
+    uint32_t pos = 0;
+    while (pos < len) {
+        uint32_t end = cmd.find(',', pos);
+        if (end == string::npos) {
+            end = len;
+        }
+        int status = REPLY_CMD_WRONG;
+        bool valid = true;
+
+        // Optional item header, "hdr:"
+        uint32_t dataPos = pos;
+        uint32_t colon = cmd.find(':', pos);
+        if (colon < end) {
+            valid = SetHeader(cmd.substr(pos, colon - pos));
+            dataPos = colon + 1;
+        }
+        else {
+            config->setBytesProperty(PAR_HEADER_BYTES, &hdrBytes);
+            config->setBytesProperty(PAR_CAN_PRIORITY_BITS, &cpBytes);
+        }
+
+        if (valid && dataPos < end) {
+            batchCollector.reset();
+            for (uint32_t i = dataPos; i < end; i++) {
+                batchCollector.putChar(cmd[i]);
+            }
+            batchCollector.complete();
+            if (batchCollector.isData()) {
+                status = OBDProfile::instance()->onRequest(&batchCollector);
+            }
+        }
+
+        if (binaryMode) {
+            BinaryLink::instance()->sendStatus(status);
+        }
+        else if (status == REPLY_CMD_WRONG) {
+            AdptSendReply(ErrMessage);
+        }
+        pos = end + 1;
     }
-    cpBytes.length = cp.length() / 2;
-    AdapterConfig::instance()->setBytesProperty(PAR_CAN_PRIORITY_BITS, &cpBytes);
-    hdrBytes.length = hdr.length() / 2;
-    AdapterConfig::instance()->setBytesProperty(PAR_HEADER_BYTES, &hdrBytes);
-    AdptSendReply(OkMessage);
+
+    config->setBytesProperty(PAR_HEADER_BYTES, &hdrBytes);
+    config->setBytesProperty(PAR_CAN_PRIORITY_BITS, &cpBytes);
 }
 
 /**
@@ -535,6 +793,62 @@ static void SetDefault()
     config->setIntProperty(PAR_CAN_TSTR_ADDRESS, TESTER_ADDRESS);
     config->setIntProperty(PAR_CAN_TSTR_ADDRESS, 0xF1);
     config->setIntProperty(PAR_VPW_SPEED, 1);
+    config->setIntProperty(PAR_SET_BRD, 0x0F);
+    
+    // The stored settings, ATPPFFON/ATM1
+    config->restore();
+    uint32_t protocol = config->getIntProperty(PAR_PROTOCOL);
+    if (protocol != PROT_AUTO) {
+        OBDProfile::instance()->setProtocol(protocol, true);
+    }
+}
+
+/**
+ * Store the current settings to apply on reset, "ATPPFFON"
+ * @param[in] cmd Command line, ignored
+ * @param[in] par The number in dispatch table, ignored
+ */
+static void OnStoreParamsOn(const string& cmd, int par)
+{
+    AdapterConfig::instance()->storeParams(true);
+    AdptSendReply(OkMessage);
+}
+
+/**
+ * Use the default settings on reset, "ATPPFFOFF"
+ * @param[in] cmd Command line, ignored
+ * @param[in] par The number in dispatch table, ignored
+ */
+static void OnStoreParamsOff(const string& cmd, int par)
+{
+    AdapterConfig::instance()->storeParams(false);
+    AdptSendReply(OkMessage);
+}
+
+/**
+ * Memory on, the last protocol is used on reset, "ATM1"
+ * @param[in] cmd Command line, ignored
+ * @param[in] par The number in dispatch table
+ */
+static void OnSetMemoryOn(const string& cmd, int par)
+{
+    auto config = AdapterConfig::instance();
+    config->setBoolProperty(par, true);
+    config->storeProtocol(true, OBDProfile::instance()->getProtocol());
+    AdptSendReply(OkMessage);
+}
+
+/**
+ * Memory off, "ATM0"
+ * @param[in] cmd Command line, ignored
+ * @param[in] par The number in dispatch table
+ */
+static void OnSetMemoryOff(const string& cmd, int par)
+{
+    auto config = AdapterConfig::instance();
+    config->setBoolProperty(par, false);
+    config->storeProtocol(false, PROT_AUTO);
+    AdptSendReply(OkMessage);
 }
 
 /**
@@ -560,6 +874,58 @@ static void OnReset(const string& cmd, int par)
     AdptSendReply(Interface);
 }
 
+/**
+ * Add the request to the poll list, "ATPLA pppp data", pppp is the period in ms
+ * @param[in] cmd Command line
+ * @param[in] par The number in dispatch table, ignored
+ */
+static void OnPollAdd(const string& cmd, int par)
+{
+    uint32_t period = stoul(cmd.substr(0, 4), 0, 16);
+    if (period != ULONG_MAX && PollScheduler::instance()->add(period, cmd.substr(4))) {
+        AdptSendReply(OkMessage);
+    }
+    else {
+        AdptSendReply(ErrMessage);
+    }
+}
+
+/**
+ * Clear the poll list, "ATPLC"
+ * @param[in] cmd Command line, ignored
+ * @param[in] par The number in dispatch table, ignored
+ */
+static void OnPollClear(const string& cmd, int par)
+{
+    PollScheduler::instance()->clear();
+    AdptSendReply(OkMessage);
+}
+
+/**
+ * Report the last poll run statistics, "ATPLR"
+ * @param[in] cmd Command line, ignored
+ * @param[in] par The number in dispatch table, ignored
+ */
+static void OnPollReport(const string& cmd, int par)
+{
+    PollScheduler::instance()->report();
+}
+
+/**
+ * Start polling until any key pressed, "ATPLS"
+ * @param[in] cmd Command line, ignored
+ * @param[in] par The number in dispatch table, ignored
+ */
+static void OnPollStart(const string& cmd, int par)
+{
+    PollScheduler* scheduler = PollScheduler::instance();
+    if (scheduler->isEmpty()) {
+        AdptSendReply(ErrMessage);
+        return;
+    }
+    scheduler->run();
+}
+
 typedef void (*ParCallbackT)(const string& cmd, int par);
 
 struct DispatchType {
@@ -570,7 +936,8 @@ struct DispatchType {
     ParCallbackT callback;
 };
 
-static const DispatchType dispatchTbl[] = {
+// Sorted by name, the lookup is binary search
+static constexpr DispatchType dispatchTbl[] = {
     { "#1",     PAR_CHIP_COPYRIGHT,    0,  0, OnSendReplyCopyright   },
     { "#3",     PAR_WIRING_TEST,       0,  0, OnWiringTest           },
     { "#RSN",   PAR_GET_SERIAL,        0,  0, OnGetSerialNum         },
@@ -581,9 +948,11 @@ static const DispatchType dispatchTbl[] = {
     { "AT1",    PAR_ADPTV_TIM1,        0,  0, OnSetAT1               },
     { "AT2",    PAR_ADPTV_TIM2,        0,  0, OnSetAT2               },
     { "BD",     PAR_BUFFER_DUMP,       0,  0, OnBufferDump           },
-    { "AL",     PAR_ALLOW_LONG,        0,  0, OnSetOK                },
     { "BI",     PAR_BYPASS_INIT,       0,  0, OnSetValueTrue         },
-    { "BRD",    PAR_TRY_BRD,           2,  2, OnSetValueInt          },
+    { "BM0",    PAR_BINARY_MODE,       0,  0, OnSetValueFalse        },
+    { "BM1",    PAR_BINARY_MODE,       0,  0, OnSetValueTrue         },
+    { "BQ",     PAR_BATCH_REQUEST,     2, CMD_LINE_LEN - 4, OnBatchRequest },
+    { "BRD",    PAR_TRY_BRD,           2,  2, OnTryBaudRate          },
     { "BRT",    PAR_SET_BRD,           2,  2, OnSetValueInt          },
     { "CAF0",   PAR_CAN_CAF,           0,  0, OnSetValueFalse        },
     { "CAF1",   PAR_CAN_CAF,           0,  0, OnSetValueTrue         },
@@ -597,6 +966,8 @@ static const DispatchType dispatchTbl[] = {
     { "CM",     PAR_CAN_MASK,          3,  3, OnCanSetFilterAndMask  },
     { "CM",     PAR_CAN_MASK,          8,  8, OnCanSetFilterAndMask  },
     { "CP",     PAR_CAN_PRIORITY_BITS, 2,  2, OnSetBytes             },
+    { "CR0",    PAR_CAN_REASSEMBLE,    0,  0, OnSetValueFalse        },
+    { "CR1",    PAR_CAN_REASSEMBLE,    0,  0, OnSetValueTrue         },
     { "CRA",    PAR_CAN_SET_ADDRESS,   0,  0, OnCanSetReceiveAddress },
     { "CRA",    PAR_CAN_SET_ADDRESS,   3,  3, OnCanSetReceiveAddress },
     { "CRA",    PAR_CAN_SET_ADDRESS,   8,  8, OnCanSetReceiveAddress },
@@ -630,20 +1001,32 @@ static const DispatchType dispatchTbl[] = {
     { "JHF1",   PAR_J1939_HEADER,      0,  0, OnSetValueTrue         },
     { "JS",     PAR_J1939_FMT,         0,  0, OnSetValueTrue         },
     { "JTM",    PAR_J1939_TIMEOUT_MLT, 1,  1, OnSetTimeoutMult       },
+    { "KA0",    PAR_KWP_TIMING,        0,  0, OnSetValueFalse        },
+    { "KA1",    PAR_KWP_TIMING,        0,  0, OnSetValueTrue         },
+    { "KS",     PAR_KWP_SPEED,         2,  2, OnSetKwpSpeed          },
+    { "KT0",    PAR_KLINE_TUNE,        0,  0, OnSetValueFalse        },
+    { "KT1",    PAR_KLINE_TUNE,        0,  0, OnSetValueTrue         },
     { "KW",     PAR_KW_DISPLAY,        0,  0, OnKwDisplay            },
     { "KW0",    PAR_KW_CHECK,          0,  0, OnSetValueFalse        },
     { "KW1",    PAR_KW_CHECK,          0,  0, OnSetValueTrue         },
     { "L0",     PAR_LINEFEED,          0,  0, OnSetValueFalse        },
     { "L1",     PAR_LINEFEED,          0,  0, OnSetValueTrue         },
     { "LP",     PAR_LOW_POWER_MODE,    0,  0, OnSetOK                },
-    { "M0",     PAR_MEMORY,            0,  0, OnSetValueFalse        },
-    { "M1",     PAR_MEMORY,            0,  0, OnSetValueTrue         },
+    { "M0",     PAR_MEMORY,            0,  0, OnSetMemoryOff         },
+    { "M1",     PAR_MEMORY,            0,  0, OnSetMemoryOn          },
+    { "MA",     PAR_MONITOR,           0,  0, OnMonitorAll           },
     { "MP",     PAR_J1939_MONITOR,     4,  7, OnJ1939MonitorMP       },
+    { "MR",     PAR_MONITOR,           2,  2, OnMonitorReceiver      },
+    { "MT",     PAR_MONITOR,           2,  2, OnMonitorTransmitter   },
     { "NL",     PAR_ALLOW_LONG,        0,  0, OnSetValueTrue         },
     { "PB",     PAR_USER_B,            4,  4, OnSetBytes             },
     { "PC",     PAR_PROTOCOL_CLOSE,    0,  0, OnProtocolClose        },
-    { "PPFFON", PAR_DUMMY,             0,  0, OnSetOK                },
-    { "PPFFOFF",PAR_DUMMY,             0,  0, OnSetOK                },
+    { "PLA",    PAR_POLL_SCHEDULE,     6, 21, OnPollAdd              },
+    { "PLC",    PAR_POLL_SCHEDULE,     0,  0, OnPollClear            },
+    { "PLR",    PAR_POLL_SCHEDULE,     0,  0, OnPollReport           },
+    { "PLS",    PAR_POLL_SCHEDULE,     0,  0, OnPollStart            },
+    { "PPFFOFF",PAR_DUMMY,             0,  0, OnStoreParamsOff       },
+    { "PPFFON", PAR_DUMMY,             0,  0, OnStoreParamsOn        },
     { "R0",     PAR_RESPONSES,         0,  0, OnSetValueFalse        },
     { "R1",     PAR_RESPONSES,         0,  0, OnSetValueTrue         },
     { "RA",     PAR_RECEIVE_ADDRESS,   2,  2, OnSetValueInt          },
@@ -671,61 +1054,152 @@ static const DispatchType dispatchTbl[] = {
     { "Z",      PAR_RESET_CPU,         0,  0, OnReset                }
 };
 
-static bool ValidateArgLength(const DispatchType& entry, const string& arg)
+static bool ValidateArgLength(const DispatchType& entry, uint32_t len)
 {
-    int len = arg.length();
     return len >= entry.minParNum && len <= entry.maxParNum;
 }
 
+static constexpr int DispatchTblLen = sizeof(dispatchTbl) / sizeof(dispatchTbl[0]);
+
 /**
- * Dispatch the AT command to the proper handler with particular type
- * @param[in] cmdString Command line
- * @return true if command was dispatched, false otherwise
+ * Compile time string comparison
  */
-static bool DispatchATCmd(const string& cmdString, int numOfChar, bool extraPar)
+static constexpr int CompareNames(const char* s1, const char* s2)
 {
-     // Ignore first two "AT" chars
-    string atcmd = extraPar ? cmdString.substr(2, numOfChar) : cmdString.substr(2);
+    return (*s1 != *s2 || *s1 == 0) ? (*s1 - *s2) : CompareNames(s1 + 1, s2 + 1);
+}
 
-    for (const DispatchType& dt : dispatchTbl) {
-        bool cmdType = dt.minParNum > 0;
+/**
+ * Compile time check the dispatch table is sorted
+ */
+static constexpr bool IsTableSorted(int i)
+{
+    return (i + 1 >= DispatchTblLen) ? true :
+        (CompareNames(dispatchTbl[i].name, dispatchTbl[i + 1].name) <= 0 && IsTableSorted(i + 1));
+}
+
+static_assert(IsTableSorted(0), "dispatchTbl must be sorted by name");
+
+/**
+ * Compare the table name with the command name
+ * @param[in] tblName Null terminated table name
+ * @param[in] name Command name, not null terminated
+ * @param[in] nameLen Command name length
+ * @return <0, 0, >0 like strcmp
+ */
+static int CompareName(const char* tblName, const char* name, uint32_t nameLen)
+{
+    int cmp = strncmp(tblName, name, nameLen);
+    return (cmp == 0) ? (tblName[nameLen] != 0) : cmp;
+}
+
+/**
+ * Find the dispatch table entry by the command name and argument length
+ * @param[in] name Command name, not null terminated
+ * @param[in] nameLen Command name length
+ * @param[in] argLen Argument length
+ * @return The table index, -1 if not found
+ */
+static int FindATCmd(const char* name, uint32_t nameLen, uint32_t argLen)
+{
+    const bool extraPar = argLen > 0;
+    
+    // Find the first entry with the same name
+    int first = 0;
+    int last = DispatchTblLen;
+    while (first < last) {
+        int mid = (first + last) / 2;
+        if (CompareName(dispatchTbl[mid].name, name, nameLen) < 0) {
+            first = mid + 1;
+        }
+        else {
+            last = mid;
+        }
+    }
+
+    for (int i = first; i < DispatchTblLen; i++) {
+        const DispatchType& dt = dispatchTbl[i];
+        if (CompareName(dt.name, name, nameLen) != 0)
+            break;
         
-        if ((cmdType == extraPar) && (atcmd == dt.name)) {
-            string arg = extraPar ? cmdString.substr(numOfChar + 2) : "";
+        bool cmdType = dt.minParNum > 0;
+        if (cmdType != extraPar)
+            continue;
+        // Argument length validation if we have an argument
+        if (extraPar && !ValidateArgLength(dt, argLen))
+            continue;
+        return i;
+    }
+    return -1;
+}
 
-            // Argument length validation if we have an argument
-            if (extraPar && !ValidateArgLength(dt, arg)) {
-                continue;
-            }
-            
-            // Have callback?
-            if (!dt.callback)
-                return false;
-            
-            dt.callback(arg, dt.id);
-            return true;
+/**
+ * Resolve AT sequence to the dispatch table entry, allocation free,
+ * called from UART RX interrupt once the command line is complete
+ * @param[in] cmdString The user command
+ * @param[out] argPos The argument position in the command line
+ * @return The table index, -1 if not found
+ */
+int AdptResolveCmd(const string& cmdString, uint32_t& argPos)
+{
+    const uint32_t len = cmdString.length();
+    if (len < 2 || cmdString[0] != 'A' || cmdString[1] != 'T')
+        return -1;
+
+    // Ignore first two "AT" chars
+    const char* atcmd = cmdString.c_str() + 2;
+    const uint32_t atLen = len - 2;
+
+    // Do exact string match, like "AT#DP"
+    int idx = FindATCmd(atcmd, atLen, 0);
+    if (idx >= 0) {
+        argPos = len;
+        return idx;
+    }
+
+    // Four, three and two char sequence prefixes
+    for (uint32_t numOfChar = 4; numOfChar >= 2; numOfChar--) {
+        if (atLen <= numOfChar)
+            continue;
+        idx = FindATCmd(atcmd, numOfChar, atLen - numOfChar);
+        if (idx >= 0) {
+            argPos = numOfChar + 2;
+            return idx;
         }
     }
-    return false;
+    return -1;
 }
 
 /**
- * Parse and dispatch AT sequence
- * @param[in] cmdString The user command 
- * @return true if command was parsed, false otherwise
+ * Dispatch the resolved AT command to the proper handler
+ * @param[in] collector The user command
+ * @return true if command was dispatched, false otherwise
  */
-static bool ParseGenericATCmd(const string& cmdString)
+static bool DispatchATCmd(const DataCollector* collector)
 {
-    bool dispatched = DispatchATCmd(cmdString, 4, false); // Do exact string match, like "AT#DP"
-    if (dispatched)
-        return true;
-    dispatched = DispatchATCmd(cmdString, 4, true); // Four char sequence prefixes
-    if (dispatched)
-        return true;
-    dispatched = DispatchATCmd(cmdString, 3, true); // Three char sequence prefixes
-    if (dispatched)
-        return true;
-    return DispatchATCmd(cmdString, 2, true); // Two char sequence prefixes
+    int idx = collector->getCmdIndex();
+    if (idx < 0)
+        return false;
+
+    const DispatchType& dt = dispatchTbl[idx];
+    
+    // Have callback?
+    if (!dt.callback)
+        return false;
+
+    // Preallocated, the argument never exceeds the collector string length
+    static string arg(CMD_LINE_LEN + 1);
+    
+    const string& cmdString = collector->getString();
+    uint32_t argPos = collector->getArgPos();
+    if (argPos < cmdString.length()) {
+        arg = cmdString.c_str() + argPos;
+    }
+    else {
+        arg.clear();
+    }
+    dt.callback(arg, dt.id);
+    return true;
 }
 
 /**
@@ -735,7 +1209,8 @@ static bool ParseGenericATCmd(const string& cmdString)
 void AdptOnCmd(const DataCollector* collector)
 {
     static DataCollector previousCmd(OBD_IN_MSG_DLEN);
-    bool succeeded = false;
+    bool binaryMode = BinaryLink::isActive(); // the mode changes after the status only
+    int status = REPLY_OK;
     
     const DataCollector* activeCollector = collector;
     
@@ -748,22 +1223,22 @@ void AdptOnCmd(const DataCollector* collector)
     }
 
     if (activeCollector->isData()) { // Should be only digits
-        OBDProfile::instance()->onRequest(activeCollector);
-        succeeded = true;
+        status = OBDProfile::instance()->onRequest(activeCollector);
     }
-    else {
-        const string& cmdString = activeCollector->getString();
-        string key = cmdString.substr(0,2);
-
-        if (key == "AT") { // AT sequence
-            succeeded = ParseGenericATCmd(cmdString); // String cmd->numeric
+    else if (!DispatchATCmd(activeCollector)) { // AT sequence, already resolved
+        status = REPLY_CMD_WRONG;
+        if (!binaryMode) {
+            AdptSendReply(ErrMessage);
         }
     }
 
-    if (!succeeded) {
-        AdptSendReply(ErrMessage);
+    if (binaryMode) {
+        BinaryLink::instance()->sendStatus(status);
     }
-    AdptSendString(">");
+    else {
+        AdptSendString(">");
+    }
+    BinaryLink::instance()->update();
 }
 
 /**
@@ -772,6 +1247,7 @@ void AdptOnCmd(const DataCollector* collector)
 void AdptDispatcherInit() 
 {
     OnReset("", PAR_RESET_CPU);
+    BinaryLink::instance()->update();
     AdptSendString(">");
 }
 
@@ -789,9 +1265,13 @@ void AdptCheckHeartBeat()
  */
 void AdptSendReply(const char* str)
 {
-    string s(strlen(str) + 2); // avoid unnecessary re-allocation, allocate the exact number of bytes
-    s = str;
-    AdptSendReply(s);
+    if (BinaryLink::isActive()) {
+        BinaryLink::instance()->sendText(str, strlen(str));
+        return;
+    }
+    ReplyWriter writer;
+    writer.put(str);
+    writer.endl();
 }
 
 /**
@@ -800,9 +1280,7 @@ void AdptSendReply(const char* str)
  */
 void AdptSendReply(const string& str)
 {
-    string s(str.length() + 2); // avoid unnecessary re-allocation, allocate the exact number of bytes
-    s = str;
-    AdptSendReply(s); // use the next one
+    AdptSendReply(str.c_str());
 }
 
 /**
@@ -811,12 +1289,5 @@ void AdptSendReply(const string& str)
  */
 void AdptSendReply(string& str)
 {
-    if (AdapterConfig::instance()->getBoolProperty(PAR_LINEFEED)) {
-        str += "\r\n";
-        AdptSendString(str);
-    }
-    else {
-        str += "\r";
-        AdptSendString(str);
-    }
+    AdptSendReply(str.c_str());
 }
@@ -8,6 +8,8 @@
 #include <algorithms.h>
 #include "adaptertypes.h"
 #include "ecumsg.h"
+#include "replywriter.h"
+#include "binarylink.h"
 
 using namespace util;
 
@@ -110,27 +112,17 @@ Ecumsg::~Ecumsg()
 }
 
 /**
- * Get the string representation of message bytes
- * @param[out] str The output string
+ * Send the string representation of message bytes
  */
 void Ecumsg::sendReply() const
 {
-    const uint32_t OutLen = TX_BUFFER_LEN;
-    static string str(OutLen * 3);
-    uint32_t msgLen = length_;
-    Spacer spacer(str);
-    
-    for (int n = 0; msgLen > 0; n += OutLen) {
-        uint32_t len = min(msgLen, OutLen);
-        to_ascii(&data_[n], len, str);
-        msgLen -= len;
-        if (msgLen > 0) {
-            spacer.space();
-        }
-        AdptSendString(str);
-        str.resize(0);
+    if (BinaryLink::isActive()) {
+        BinaryLink::instance()->sendMessage(0, false, data_, length_);
+        return;
     }
-    AdptSendReply(""); // line terminator
+    ReplyWriter writer;
+    writer.hex(data_, length_);
+    writer.endl();
 }
 
 /**
@@ -5,10 +5,10 @@
  *
  */
 
-#include <climits>
 #include <LPC15xx.h>
 #include <lstring.h>
 #include <algorithms.h>
+#include <hexcodec.h>
 #include "adaptertypes.h"
 
 using namespace std;
@@ -118,21 +118,7 @@ void KWordsToString(const uint8_t* kw, string& str)
  **/
 uint32_t to_bytes(const string& str, uint8_t* bytes)
 {
-    int len = str.length();
-    
-    if ((len % 2) != 0) {
-        len--; // Skip the last digit
-    }
-    
-    int j = 0;
-    for (int i = 0; i < len / 2; i++) {
-        uint32_t hexValue = stoul(str.substr(j, 2), 0, 16);
-        if (hexValue == ULONG_MAX)
-            return 0;
-        bytes[i] = hexValue;
-        j += 2;
-    }
-    return len / 2;
+    return hex_decode(str.c_str(), str.length(), bytes);
 }
 
 /**
@@ -143,14 +129,18 @@ uint32_t to_bytes(const string& str, uint8_t* bytes)
  **/
 void to_ascii(const uint8_t* bytes, uint32_t length, string& str)
 {
-    Spacer spacer(str);
-    for (int i = 0; i < length; i++) {
-        str += to_ascii(bytes[i] >> 4);
-        str += to_ascii(bytes[i] & 0x0F);
-        spacer.space();
-    }
-    if (spacer.isSpaces() && str.length() > 0) {
-        str.resize(str.length() - 1); // Truncate the last space
+    const uint32_t ChunkLen = 16;
+    char buff[ChunkLen * 3];
+    bool spaces = AdapterConfig::instance()->getBoolProperty(PAR_SPACES);
+
+    str.reserve(str.length() + length * 3 + 1);
+    for (uint32_t i = 0; i < length; i += ChunkLen) {
+        uint32_t n = min(length - i, ChunkLen);
+        if (spaces && i > 0) {
+            str += ' ';
+        }
+        uint32_t len = spaces ? hex_encode_spaced(bytes + i, n, buff) : hex_encode(bytes + i, n, buff);
+        str.append(buff, len);
     }
 }
 
@@ -1,11 +1,29 @@
 /**
  * See the file LICENSE for redistribution information.
  *
- * Copyright (c) 2009-2016 ObdDiag.Net. All rights reserved.
+ * Copyright (c) 2009-2018 ObdDiag.Net. All rights reserved.
  *
  */
 
+#include <cstring>
+#include <EepromDriver.h>
+#include <crc16.h>
 #include "autoadapter.h"
+#include "isoserial.h"
+#include "timeoutmgr.h"
+
+using namespace util;
+
+const uint16_t STATS_MAGIC = 0xA55C;
+const uint8_t  NO_PROTOCOL = 0xFF;
+const uint16_t SAVE_EVERY  = 8;      // Spare EEPROM, do not save each success
+const uint32_t PROBE_MARGIN = 100;   // ms, on top of the probe P2 timeout
+const int      ISO_PROBE   = 2;      // The index of ISO in probe order
+
+// The default probe order
+static const int ProbeAdapters[ProtocolStats::PROBE_NUM] = {
+    ADPTR_PWM, ADPTR_VPW, ADPTR_ISO, ADPTR_CAN, ADPTR_CAN_EXT
+};
 
 void AutoAdapter::getDescription()
 {
@@ -35,33 +53,127 @@ int AutoAdapter::doConnect(int protocol, bool sendReply)
     return 0;
 }
 
+/**
+ * Read the detection statistics from EEPROM, start from scratch if not valid
+ */
+void AutoAdapter::loadStats()
+{
+    loaded_ = true;
+    uint8_t* data = reinterpret_cast<uint8_t*>(&stats_);
+    uint32_t len = sizeof(ProtocolStats) - sizeof(stats_.crc);
+    if (EepromDriver::read(EEPROM_PROTOCOL_ADDR, data, sizeof(ProtocolStats)) &&
+        stats_.magic == STATS_MAGIC && stats_.crc == crc16(data, len)) {
+        if (stats_.last >= ProtocolStats::PROBE_NUM) {
+            stats_.last = NO_PROTOCOL;
+        }
+        return;
+    }
+    memset(&stats_, 0, sizeof(ProtocolStats));
+    stats_.magic = STATS_MAGIC;
+    stats_.last = NO_PROTOCOL;
+}
+
+/**
+ * Count the successful detection and write the statistics to EEPROM
+ * @param[in] index The detected protocol, index of probe order
+ */
+void AutoAdapter::saveStats(int index)
+{
+    bool changed = (stats_.last != index);
+    stats_.last = index;
+    if (++stats_.success[index] == 0xFFFF) { // Keep the ratio, halve all
+        for (int i = 0; i < ProtocolStats::PROBE_NUM; i++) {
+            stats_.success[i] /= 2;
+        }
+    }
+    if (!changed && (stats_.success[index] % SAVE_EVERY) != 0)
+        return;
+    
+    uint8_t* data = reinterpret_cast<uint8_t*>(&stats_);
+    stats_.crc = crc16(data, sizeof(ProtocolStats) - sizeof(stats_.crc));
+    EepromDriver::write(EEPROM_PROTOCOL_ADDR, data, sizeof(ProtocolStats));
+}
+
+/**
+ * The probe order, the last detected protocol first, then by the success count
+ * @param[out] order The indexes of ProbeAdapters
+ */
+void AutoAdapter::getProbeOrder(int* order)
+{
+    int num = 0;
+    if (stats_.last != NO_PROTOCOL) {
+        order[num++] = stats_.last;
+    }
+    for (int i = 0; i < ProtocolStats::PROBE_NUM; i++) {
+        if (i == stats_.last)
+            continue;
+        // Insertion sort, stable for equal counts to keep the default order
+        int j = num++;
+        for (; j > 0 && (j > 1 || stats_.last == NO_PROTOCOL); j--) {
+            if (stats_.success[order[j - 1]] >= stats_.success[i])
+                break;
+            order[j] = order[j - 1];
+        }
+        order[j] = i;
+    }
+}
+
+/**
+ * Probe the protocols, the most likely first. The ISO 5bps init runs
+ * in the background while the other protocols are probed.
+ * @param[in] sendReply Send the reply
+ * @return The protocol detected, 0 if none
+ */
 int AutoAdapter::onConnectEcu(bool sendReply)
 {
     int protocol = 0;
     connected_ = false;
     sts_ = REPLY_NO_DATA;
     
-    // PWM
-    protocol = doConnect(ADPTR_PWM, sendReply);
-    if (protocol > 0)
-        return protocol;
+    if (!loaded_) {
+        loadStats();
+    }
     
-    // VPW
-    protocol = doConnect(ADPTR_VPW, sendReply);
-    if (protocol > 0)
-        return protocol;
+    int order[ProtocolStats::PROBE_NUM];
+    bool probed[ProtocolStats::PROBE_NUM] = { false };
+    getProbeOrder(order);
     
-    // ISO
-    protocol = doConnect(ADPTR_ISO, sendReply);
-    if (protocol > 0)
-        return protocol;
+    IsoSerialAdapter* iso = static_cast<IsoSerialAdapter*>(ProtocolAdapter::getAdapter(ADPTR_ISO));
+    if (iso->startSlowInit()) {
+        // Should be done before the 5bps init completes, not to miss the ECU sync byte
+        uint32_t probeTime = TimeoutManager::instance()->at0Timeout() + PROBE_MARGIN;
+        for (int i = 0; i < ProtocolStats::PROBE_NUM; i++) {
+            if (order[i] == ISO_PROBE)
+                continue;
+            if (iso->slowInitRemaining() < probeTime)
+                break;
+            probed[order[i]] = true;
+            protocol = doConnect(ProbeAdapters[order[i]], sendReply);
+            if (protocol > 0) {
+                iso->stopSlowInit();
+                saveStats(order[i]);
+                return protocol;
+            }
+        }
+        
+        // The window is closed, the ISO handshake goes first not to miss the sync byte
+        probed[ISO_PROBE] = true;
+        protocol = doConnect(ProbeAdapters[ISO_PROBE], sendReply);
+        iso->stopSlowInit(); // Done by the handshake already, unless it failed early
+        if (protocol > 0) {
+            saveStats(ISO_PROBE);
+            return protocol;
+        }
+    }
     
-    // CAN
-    protocol = doConnect(ADPTR_CAN, sendReply);
-    if (protocol > 0)
-        return protocol;
-
-    // CAN 29
-    return doConnect(ADPTR_CAN_EXT, sendReply);
+    for (int i = 0; i < ProtocolStats::PROBE_NUM; i++) {
+        if (probed[order[i]])
+            continue;
+        protocol = doConnect(ProbeAdapters[order[i]], sendReply);
+        if (protocol > 0) {
+            saveStats(order[i]);
+            return protocol;
+        }
+    }
+    return 0;
 }
-
@@ -1,7 +1,7 @@
 /**
  * See the file LICENSE for redistribution information.
  *
- * Copyright (c) 2009-2016 ObdDiag.Net. All rights reserved.
+ * Copyright (c) 2009-2018 ObdDiag.Net. All rights reserved.
  *
  */
 
@@ -10,9 +10,21 @@
 
 #include "padapter.h"
 
+// The auto detection statistics, kept in EEPROM
+//
+struct ProtocolStats {
+    const static int PROBE_NUM = 5; // PWM, VPW, ISO, CAN, CAN 29
+    
+    uint16_t magic;
+    uint8_t  last;                  // the last detected, the index of probe order
+    uint8_t  reserved;
+    uint16_t success[PROBE_NUM];
+    uint16_t crc;
+};
+
 class AutoAdapter : public ProtocolAdapter {
 public:
-    AutoAdapter() { connected_ = false; }
+    AutoAdapter() { connected_ = false; loaded_ = false; }
     virtual int onConnectEcu(bool sendReply);
     virtual int onRequest(const uint8_t* data, uint32_t len, uint32_t numOfRes);
     virtual void getDescription();
@@ -21,6 +33,11 @@ public:
     virtual void wiringCheck() {}
 private:
     int doConnect(int protocol, bool sendReply);
+    void loadStats();
+    void saveStats(int index);
+    void getProbeOrder(int* order);
+    bool          loaded_;
+    ProtocolStats stats_;
 };
 
 #endif //__AUTO_PROFILE_H__
@@ -5,22 +5,32 @@
  *
  */
 
-#include <cstdio>
 #include <adaptertypes.h>
 #include <algorithms.h>
 #include <Timer.h>
 #include <CanDriver.h>
+#include <CmdUart.h>
 #include <led.h>
+#include <replywriter.h>
+#include <binarylink.h>
 #include "canhistory.h"
 #include "canmsgbuffer.h"
 #include "obdprofile.h"
 #include "isocan.h"
+#include "respondersets.h"
 #include "j1979.h"
 #include "timeoutmgr.h"
 
 using namespace std;
 using namespace util;
 
+const uint32_t N_BS_TIMEOUT = 1000; // ms, wait for flow control
+const uint32_t N_AS_TIMEOUT = 1000; // ms, frame transmit
+const uint32_t N_CR_TIMEOUT = 1000; // ms, wait for the next consecutive frame
+const int      N_WFT_MAX    = 10;   // max number of FC.WAIT in a row
+const int      FC_CTS       = 0;
+const int      FC_WAIT      = 1;
+
 /**
  * Constructor, set helper objects pointers
  */
@@ -31,6 +41,15 @@ IsoCanAdapter::IsoCanAdapter()
     history_    = new CanHistory();
     sts_        = REPLY_NO_DATA;
     canExtAddr_ = false;
+    reassemble_ = false;
+    learn_      = false;
+    requestSig_ = 0;
+    responders_ = new ResponderSets();
+    rxArena_    = new uint8_t[ISOTP_MAX_DLEN]; // Heap alocation, shared by contexts
+    rxArenaPos_ = 0;
+    for (int i = 0; i < ISOTP_RX_CONTEXTS; i++) {
+        rxContexts_[i].active = false;
+    }
 }
 
 /**
@@ -66,8 +85,136 @@ bool IsoCanAdapter::sendToEcu(const uint8_t* buff, int length)
         return sendFrameToEcu(data, totalLen, dlc);
     }
     else {
+        return sendMultiFrameToEcu(buff, length);
+    }
+}
+
+/**
+ * Convert the flow control STmin to microseconds
+ * @param[in] stmin STmin byte
+ * @return The separation time in microseconds
+ */
+static uint32_t StminToUsec(uint8_t stmin)
+{
+    if (stmin <= 0x7F)
+        return stmin * 1000;
+    if (stmin >= 0xF1 && stmin <= 0xF9)
+        return (stmin - 0xF0) * 100;
+    return 0x7F * 1000; // reserved, use the longest
+}
+
+/**
+ * Send the ISO 15765-2 segmented message, the first frame then the
+ * consecutive frames in blocks as the ECU flow control requests
+ * @param[in] buff The message data bytes
+ * @param[in] length The message length, up to 4095
+ * @return true if OK, false if no flow control or ECU overflow
+ */
+bool IsoCanAdapter::sendMultiFrameToEcu(const uint8_t* buff, int length)
+{
+    uint8_t data[CAN_FRAME_LEN];
+    int i = 0;
+    
+    const ByteArray* canExt = config_->getBytesProperty(PAR_CAN_EXT);
+    if (canExt->length) { // CAN extended addressing
+        data[i++] = canExt->data[0];
+    }
+    data[i++] = (CANFirstFrame << 4) | (length >> 8);
+    data[i++] = length & 0xFF;
+    int pos = CAN_FRAME_LEN - i;
+    memcpy(data + i, buff, pos);
+    if (!sendFrameToEcu(data, CAN_FRAME_LEN, CAN_FRAME_LEN))
         return false;
+    
+    uint8_t sn = 1;
+    int waitNum = 0;
+    while (pos < length) {
+        uint8_t fs, bs, stmin;
+        if (!receiveControlFrame(fs, bs, stmin))
+            return false; // N_Bs timeout
+        
+        if (fs == FC_WAIT) {
+            if (++waitNum > N_WFT_MAX)
+                return false;
+            continue;
+        }
+        if (fs != FC_CTS)
+            return false; // Overflow or invalid
+        waitNum = 0;
+        
+        if (!sendConsecutiveFrames(buff, length, pos, sn, bs, stmin))
+            return false;
     }
+    return true;
+}
+
+/**
+ * Send the block of consecutive frames, paced by STmin on microsecond clock.
+ * With STmin 0 the frames are queued back to back to the TX mailboxes.
+ * N_As applies to every frame, the timeout starts with each wait
+ * @param[in] buff The message data bytes
+ * @param[in] length The message length
+ * @param[in,out] pos The next byte to send
+ * @param[in,out] sn The sequence number
+ * @param[in] bs The block size, 0 for no more flow control
+ * @param[in] stmin The flow control STmin
+ * @return true if OK, false if the transmit timed out
+ */
+bool IsoCanAdapter::sendConsecutiveFrames(const uint8_t* buff, int length, int& pos, uint8_t& sn, uint8_t bs, uint8_t stmin)
+{
+    MicroTimer* clock = MicroTimer::instance();
+    const uint32_t separation = StminToUsec(stmin);
+    const uint32_t timeout = N_AS_TIMEOUT * 1000;
+    const bool userB = (getProtocol() == PROT_ISO15765_USR_B); // no padding
+    const ByteArray* canExt = config_->getBytesProperty(PAR_CAN_EXT);
+    
+    CanMsgBuffer msgBuffer(getID(), extended_, CAN_FRAME_LEN, 0);
+    uint32_t start;
+    int frameNum = 0;
+    while (pos < length && (bs == 0 || frameNum < bs)) {
+        int i = 0;
+        memset(msgBuffer.data, 0, sizeof(msgBuffer.data));
+        if (canExt->length) {
+            msgBuffer.data[i++] = canExt->data[0];
+        }
+        msgBuffer.data[i++] = (CANConsecutiveFrame << 4) | (sn++ & 0x0F);
+        int len = util::min(CAN_FRAME_LEN - i, length - pos);
+        memcpy(msgBuffer.data + i, buff + pos, len);
+        msgBuffer.dlc = userB ? (i + len) : CAN_FRAME_LEN;
+        
+        if (separation && frameNum > 0) { // the gap after the previous frame is out
+            start = clock->value();
+            while (!driver_->isTxIdle()) {
+                if ((clock->value() - start) > timeout) {
+                    driver_->clearTx();
+                    return false;
+                }
+            }
+            uint32_t sent = clock->value();
+            while ((clock->value() - sent) < separation)
+                ;
+        }
+        start = clock->value();
+        while (!driver_->queue(&msgBuffer)) { // queue is full
+            if ((clock->value() - start) > timeout) {
+                driver_->clearTx();
+                return false;
+            }
+        }
+        history_->add2Buffer(&msgBuffer, true, 0);
+        pos += len;
+        frameNum++;
+    }
+
+    // The block is out before waiting for the next flow control
+    start = clock->value();
+    while (!driver_->isTxIdle()) {
+        if ((clock->value() - start) > timeout) {
+            driver_->clearTx();
+            return false;
+        }
+    }
+    return true;
 }
 
 /**
@@ -99,22 +246,21 @@ bool IsoCanAdapter::sendFrameToEcu(const uint8_t* data, uint8_t length, uint8_t
 /**
  * Format reply for "H1" option
  * @param[in] msg CanMsgbuffer instance pointer
- * @param[out] str The output string
+ * @param[out] writer The reply writer
  * @param[in] dlen The data length flag
  */
-void IsoCanAdapter::formatReplyWithHeader(const CanMsgBuffer* msg, util::string& str, int dlen)
+void IsoCanAdapter::formatReplyWithHeader(const CanMsgBuffer* msg, ReplyWriter& writer, int dlen)
 {
-    Spacer spacer(str);
     bool isDLC = AdapterConfig::instance()->getBoolProperty(PAR_CAN_DLC);
 
-    CanIDToString(msg->id, str, msg->extended);
-    spacer.space(); // number of chars + space
+    writer.canId(msg->id, msg->extended);
+    writer.space(); // number of chars + space
     
     if (isDLC) {
-        str += msg->dlc + '0'; // add DLC byte
-        spacer.space();
+        writer.put(msg->dlc + '0'); // add DLC byte
+        writer.space();
     }
-    to_ascii(msg->data, dlen, str);
+    writer.hex(msg->data, dlen);
 }
 
 /**
@@ -123,17 +269,21 @@ void IsoCanAdapter::formatReplyWithHeader(const CanMsgBuffer* msg, util::string&
  */
 void IsoCanAdapter::processFrame(const CanMsgBuffer* msg)
 {
-    util::string str;
+    if (BinaryLink::isActive()) {
+        BinaryLink::instance()->sendMessage(msg);
+        return;
+    }
+    ReplyWriter writer;
     uint32_t offst = canExtAddr_ ? 2 : 1;
     uint32_t dlen = msg->data[offst - 1];
     
     if (config_->getBoolProperty(PAR_HEADER_SHOW)) {
-        formatReplyWithHeader(msg, str, dlen + offst);
+        formatReplyWithHeader(msg, writer, dlen + offst);
     }
     else {
-        to_ascii(msg->data + offst, dlen, str);
+        writer.hex(msg->data + offst, dlen);
     }
-    AdptSendReply(str);
+    writer.endl();
 }
 
 /**
@@ -142,23 +292,26 @@ void IsoCanAdapter::processFrame(const CanMsgBuffer* msg)
  */
 void IsoCanAdapter::processFirstFrame(const CanMsgBuffer* msg)
 {
-    util::string str;
+    if (BinaryLink::isActive()) {
+        BinaryLink::instance()->sendMessage(msg);
+        return;
+    }
+    ReplyWriter writer;
     uint32_t offst = canExtAddr_ ? 2 : 1;
     uint32_t dlen = canExtAddr_ ? 5 : 6;
     uint32_t msgLen = (msg->data[offst - 1] & 0x0F) << 8 | msg->data[offst];
 
     if (config_->getBoolProperty(PAR_HEADER_SHOW)) {
-        formatReplyWithHeader(msg, str, 8);
+        formatReplyWithHeader(msg, writer, 8);
     }
     else {
-        const int STR_LEN = 4; // we need only 3 digits + null terminator
-        char slen[STR_LEN];
-        sprintf(slen, "%.3X", static_cast<unsigned>(msgLen));
-        AdptSendReply(slen);
-        str = "0: ";
-        to_ascii(msg->data + offst + 1, dlen, str);
-    }
-    AdptSendReply(str);
+        writer.nibble(msgLen >> 8); // 3 digits length
+        writer.hex(msgLen & 0xFF);
+        writer.endl();
+        writer.put("0: ");
+        writer.hex(msg->data + offst + 1, dlen);
+    }
+    writer.endl();
 }
 
 /**
@@ -168,21 +321,201 @@ void IsoCanAdapter::processFirstFrame(const CanMsgBuffer* msg)
  */
 void IsoCanAdapter::processNextFrame(const CanMsgBuffer* msg, int n)
 {
-    util::string str;
+    if (BinaryLink::isActive()) {
+        BinaryLink::instance()->sendMessage(msg);
+        return;
+    }
+    ReplyWriter writer;
     uint32_t offst = canExtAddr_ ? 2 : 1;
     uint32_t dlen = canExtAddr_ ? 6 : 7;
 
     if (config_->getBoolProperty(PAR_HEADER_SHOW)) {
-        formatReplyWithHeader(msg, str, 8);
+        formatReplyWithHeader(msg, writer, 8);
+    }
+    else {
+        writer.nibble(n & 0x0F);
+        writer.put(": ");
+        writer.hex(msg->data + offst, dlen);
+    }
+    writer.endl();
+}
+
+/**
+ * Send the reassembled payload as one line, "ATCR1"
+ * @param[in] id The responder CAN ID
+ * @param[in] extended 29 bit CAN ID flag
+ * @param[in] data The payload bytes
+ * @param[in] length The payload length
+ */
+void IsoCanAdapter::sendPayload(uint32_t id, bool extended, const uint8_t* data, uint32_t length)
+{
+    if (BinaryLink::isActive()) {
+        BinaryLink::instance()->sendMessage(id, extended, data, length, BinaryLink::MSG_FLAG_PAYLOAD);
+        return;
+    }
+    ReplyWriter writer;
+    if (config_->getBoolProperty(PAR_HEADER_SHOW)) {
+        writer.canId(id, extended);
+        writer.space();
+    }
+    writer.hex(data, length);
+    writer.endl();
+}
+
+/**
+ * Find the active receive context of the responder
+ * @param[in] id The responder CAN ID
+ * @return The context, nullptr if none
+ */
+IsoTpRxContext* IsoCanAdapter::findContext(uint32_t id)
+{
+    for (int i = 0; i < ISOTP_RX_CONTEXTS; i++) {
+        if (rxContexts_[i].active && rxContexts_[i].id == id)
+            return &rxContexts_[i];
+    }
+    return nullptr;
+}
+
+/**
+ * Start the receive context on the first frame, the unfinished transfer
+ * of the same responder is dropped. With ATCR1 the payload buffer is
+ * taken from the shared arena
+ * @param[in] msg The first frame
+ * @param[in] length The message length from the first frame
+ * @return The context, nullptr if no free context or buffer space
+ */
+IsoTpRxContext* IsoCanAdapter::openContext(const CanMsgBuffer* msg, uint32_t length)
+{
+    IsoTpRxContext* ctx = findContext(msg->id);
+    if (ctx) {
+        releaseContext(*ctx, true);
+    }
+    ctx = nullptr;
+    for (int i = 0; i < ISOTP_RX_CONTEXTS; i++) {
+        if (!rxContexts_[i].active) {
+            ctx = &rxContexts_[i];
+            break;
+        }
+    }
+    if (!ctx)
+        return nullptr;
+    
+    ctx->data = nullptr;
+    if (reassemble_) {
+        if (rxArenaPos_ + length > ISOTP_MAX_DLEN)
+            return nullptr;
+        ctx->data = rxArena_ + rxArenaPos_;
+        rxArenaPos_ += length;
+    }
+    ctx->id = msg->id;
+    ctx->extended = msg->extended;
+    ctx->length = length;
+    ctx->pos = 0;
+    ctx->sn = 1;
+    ctx->bs = getFlowBlockSize();
+    ctx->blockCount = 0;
+    ctx->frameNum = 0;
+    ctx->active = true;
+    return ctx;
+}
+
+/**
+ * Close the receive context, the arena is reclaimed when all are closed
+ * @param[in] ctx The context
+ * @param[in] error The transfer is incomplete, reported with ATCR1
+ */
+void IsoCanAdapter::releaseContext(IsoTpRxContext& ctx, bool error)
+{
+    ctx.active = false;
+    if (error && reassemble_) {
+        AdptSendReply("RX ERROR");
+    }
+    for (int i = 0; i < ISOTP_RX_CONTEXTS; i++) {
+        if (rxContexts_[i].active)
+            return;
+    }
+    rxArenaPos_ = 0;
+}
+
+/**
+ * Drop the contexts waiting for the consecutive frame longer than N_Cr
+ * @param[in] now The microsecond clock value
+ */
+void IsoCanAdapter::expireContexts(uint32_t now)
+{
+    for (int i = 0; i < ISOTP_RX_CONTEXTS; i++) {
+        IsoTpRxContext& ctx = rxContexts_[i];
+        if (ctx.active && (now - ctx.lastTime) > N_CR_TIMEOUT * 1000) {
+            releaseContext(ctx, true);
+        }
+    }
+}
+
+/**
+ * The block size of the flow control frames we send, "ATFCSD"
+ * @return The block size, 0 for no more flow control
+ */
+uint8_t IsoCanAdapter::getFlowBlockSize() const
+{
+    const ByteArray* bytes = config_->getBytesProperty(PAR_CAN_FLOW_CTRL_DAT);
+    if (!config_->getBoolProperty(PAR_CAN_FLOW_CONTROL) || config_->getIntProperty(PAR_CAN_FLOW_CTRL_MD) == 0)
+        return 0;
+    return (bytes->length >= 2) ? bytes->data[1] : 0;
+}
+
+/**
+ * Update the responder receive context with the first or consecutive frame,
+ * checks the sequence number and the total length, keeps the payload
+ * with ATCR1 and sends the next flow control after each block
+ * @param[in] msg CanMsgbuffer instance pointer
+ * @param[in] type The frame type from PCI
+ * @return The context, nullptr if the frame does not belong to any
+ */
+IsoTpRxContext* IsoCanAdapter::trackFrame(const CanMsgBuffer* msg, int type)
+{
+    uint32_t offst = canExtAddr_ ? 1 : 0;
+    const uint8_t* pci = msg->data + offst;
+    IsoTpRxContext* ctx = nullptr;
+    uint32_t dlen = 0;
+    
+    if (type == CANFirstFrame) {
+        ctx = openContext(msg, (pci[0] & 0x0F) << 8 | pci[1]);
+        if (!ctx) {
+            if (reassemble_) {
+                AdptSendReply("BUFFER FULL");
+            }
+            return nullptr;
+        }
+        dlen = CAN_FRAME_LEN - 2 - offst;
+        pci += 2;
     }
     else {
-        const int STR_LEN = 4;
-        char prefix[STR_LEN]; // space for 1.5 bytes plus null terminator
-        sprintf(prefix, "%X: ", (n & 0x0F));
-        str = prefix;
-        to_ascii(msg->data + offst, dlen, str);
+        ctx = findContext(msg->id);
+        if (!ctx)
+            return nullptr; // no first frame, ignore
+        if ((pci[0] & 0x0F) != (ctx->sn & 0x0F) && reassemble_) {
+            releaseContext(*ctx, true); // lost frame
+            return nullptr;
+        }
+        dlen = CAN_FRAME_LEN - 1 - offst;
+        pci += 1;
+        ctx->sn = (pci[-1] & 0x0F) + 1;
+        ctx->frameNum++;
+    }
+    
+    dlen = util::min(dlen, ctx->length - ctx->pos);
+    if (ctx->data) {
+        memcpy(ctx->data + ctx->pos, pci, dlen);
     }
-    AdptSendReply(str);
+    ctx->pos += dlen;
+    ctx->lastTime = MicroTimer::instance()->value();
+    
+    // The next block, the first frame is confirmed by caller
+    if (type == CANConsecutiveFrame && ctx->bs && ++ctx->blockCount == ctx->bs && ctx->pos < ctx->length) {
+        ctx->blockCount = 0;
+        processFlowFrame(msg);
+    }
+    return ctx;
 }
 
 /**
@@ -215,10 +548,21 @@ bool IsoCanAdapter::receiveFromEcu(bool sendReply, uint32_t numOfResp)
     CanMsgBuffer msgBuffer;
     bool msgReceived = false;
     canExtAddr_ = config_->getBytesProperty(PAR_CAN_EXT)->length; // set class instance member
-    int frameNum = 0;
+    reassemble_ = config_->getBoolProperty(PAR_CAN_REASSEMBLE);
+    for (int i = 0; i < ISOTP_RX_CONTEXTS; i++) {
+        rxContexts_[i].active = false;
+    }
+    rxArenaPos_ = 0;
+    
+    // The responders answered, to complete the request early
+    uint32_t doneIds[ResponderSets::MAX_RESPONDERS];
+    int doneNum = 0;
+    int learned = learn_ ? responders_->find(requestSig_) : -1;
+    bool allDone = false;
     
     Timer* timer = Timer::instance(0);
     timer->start(p2Timeout);
+    TimeoutManager::instance()->requestSent();
 
     uint32_t num = 0;
     do {
@@ -226,8 +570,8 @@ bool IsoCanAdapter::receiveFromEcu(bool sendReply, uint32_t numOfResp)
             continue;
         driver_->read(&msgBuffer);
         
-        // Measure the response time
-        TimeoutManager::instance()->p2Timeout(timer->value());
+        // Measure the response time, the first frame only
+        TimeoutManager::instance()->responseReceived(msgBuffer.id);
         
         // Message log
         history_->add2Buffer(&msgBuffer, false, msgBuffer.msgnum);
@@ -256,38 +600,86 @@ bool IsoCanAdapter::receiveFromEcu(bool sendReply, uint32_t numOfResp)
         
         // CAN extextended address
         uint8_t keyByte = canExtAddr_ ? msgBuffer.data[1] : msgBuffer.data[0];
-        switch ((keyByte & 0xF0) >> 4) {
+        int type = (keyByte & 0xF0) >> 4;
+        IsoTpRxContext* ctx = nullptr;
+        expireContexts(MicroTimer::instance()->value());
+        
+        if (type == CANFirstFrame || type == CANConsecutiveFrame) {
+            ctx = trackFrame(&msgBuffer, type);
+            if (type == CANFirstFrame) { // Stop the ECU if there is no room to reassemble
+                processFlowFrame(&msgBuffer, !ctx && reassemble_);
+            }
+        }
+        
+        // The responder message is complete
+        if ((type == CANSingleFrame && !checkResponsePending(&msgBuffer)) || (ctx && ctx->pos == ctx->length)) {
+            bool known = false;
+            for (int i = 0; i < doneNum; i++) {
+                known = known || (doneIds[i] == msgBuffer.id);
+            }
+            if (!known && doneNum < ResponderSets::MAX_RESPONDERS) {
+                doneIds[doneNum++] = msgBuffer.id;
+                allDone = (learned >= 0) && responders_->isComplete(learned, doneIds, doneNum);
+            }
+        }
+        
+        if (reassemble_) {
+            if (type == CANSingleFrame) {
+                uint32_t offst = canExtAddr_ ? 1 : 0;
+                uint32_t dlen = util::min<uint32_t>(keyByte & 0x0F, CAN_FRAME_LEN - 1 - offst);
+                sendPayload(msgBuffer.id, msgBuffer.extended, msgBuffer.data + offst + 1, dlen);
+            }
+            else if (ctx && ctx->pos == ctx->length) {
+                sendPayload(ctx->id, ctx->extended, ctx->data, ctx->length);
+                releaseContext(*ctx, false);
+            }
+            continue;
+        }
+        
+        switch (type) {
             case CANSingleFrame:
                 processFrame(&msgBuffer);
                 break;
             case CANFirstFrame:
-                processFlowFrame(&msgBuffer);
                 processFirstFrame(&msgBuffer);
                 break;
             case CANConsecutiveFrame:
-                processNextFrame(&msgBuffer, ++frameNum);
+                processNextFrame(&msgBuffer, ctx ? ctx->frameNum : 0);
+                if (ctx && ctx->pos == ctx->length) {
+                    releaseContext(*ctx, false);
+                }
                 break;
             default:
                 processFrame(&msgBuffer); // oops
         }
-    } while (!timer->isExpired() && (num < numOfResp));
+    } while (!timer->isExpired() && (num < numOfResp) && !allDone);
+
+    if (learn_) {
+        responders_->update(requestSig_, doneIds, doneNum, !allDone);
+    }
 
+    // Timed out in the middle
+    for (int i = 0; i < ISOTP_RX_CONTEXTS; i++) {
+        if (rxContexts_[i].active) {
+            releaseContext(rxContexts_[i], true);
+        }
+    }
     return msgReceived;
 }
 
 /**
- * CAN control frame handler
- * @param[in] fs Control frame FS parameter
- * @param[in] bs Control frame BS parameter
+ * CAN control frame handler, waits N_Bs for the ECU flow control
+ * @param[out] fs Control frame FS parameter
+ * @param[out] bs Control frame BS parameter
+ * @param[out] stmin Control frame STmin parameter
  * @return true if message received, false otherwise
  */
 bool IsoCanAdapter::receiveControlFrame(uint8_t& fs, uint8_t& bs, uint8_t& stmin)
 {
-    const int p2Timeout = getP2MaxTimeout();
     CanMsgBuffer msgBuffer;
     
     Timer* timer = Timer::instance(0);
-    timer->start(p2Timeout);
+    timer->start(N_BS_TIMEOUT);
 
     do {
         if (!driver_->isReady())
@@ -337,7 +729,13 @@ int IsoCanAdapter::onRequest(const uint8_t* data, uint32_t len, uint32_t numOfRe
     
     if (!sendToEcu(data, len))
         return REPLY_DATA_ERROR;
-    return receiveFromEcu(true, numOfResp) ? REPLY_NONE : REPLY_NO_DATA;
+    
+    // Learn the responders unless the number of responses is given, not with ATAT0
+    learn_ = (numOfResp == 0xFFFFFFFF) && (TimeoutManager::instance()->mode() != TimeoutManager::AT0);
+    requestSig_ = ResponderSets::signature(getID(), data, len);
+    bool received = receiveFromEcu(true, numOfResp);
+    learn_ = false;
+    return received ? REPLY_NONE : REPLY_NO_DATA;
 }
 
 /**
@@ -384,6 +782,73 @@ void IsoCanAdapter::dumpBuffer()
     history_->dumpCurrentBuffer();
 }
 
+/**
+ * Bus monitor, "ATMA", "ATMR hh" and "ATMT hh". The frames are queued by
+ * CAN ISR and printed until any key pressed or the queue overflows.
+ * For 29-bit the receiver is ID bits 15..8 and the transmitter is bits 7..0,
+ * for 11-bit both compare the ID low byte
+ * @param[in] mode The monitor mode
+ * @param[in] addr The receiver/transmitter address
+ * @return The completion status
+ */
+int IsoCanAdapter::busMonitor(int mode, uint8_t addr)
+{
+    const ByteArray* filterBytes = config_->getBytesProperty(PAR_CAN_FILTER);
+    const ByteArray* maskBytes = config_->getBytesProperty(PAR_CAN_MASK);
+    bool showHeader = config_->getBoolProperty(PAR_HEADER_SHOW);
+    bool binaryMode = BinaryLink::isActive();
+    bool silent = config_->getBoolProperty(PAR_CAN_SILENT_MODE);
+
+    if (mode == MONITOR_ALL) {
+        if (filterBytes->length || maskBytes->length) {
+            setFilterAndMask(); // ATCF/ATCM applies
+        }
+        else {
+            driver_->setFilterAndMask(0, 0, extended_);
+        }
+    }
+    else if (extended_ && mode == MONITOR_RECEIVER) {
+        driver_->setFilterAndMask(addr << 8, 0xFF00, true);
+    }
+    else {
+        driver_->setFilterAndMask(addr, 0xFF, extended_);
+    }
+    
+    if (silent) // Set silent mode
+        driver_->setSilent(true);
+    driver_->clearData();
+    uint32_t overflows = driver_->getOverflows();
+
+    CmdUart* uart = CmdUart::instance();
+    uart->monitor(true);
+    CanMsgBuffer msg;
+    do {
+        while (driver_->read(&msg)) {
+            if (binaryMode) {
+                BinaryLink::instance()->sendMessage(&msg);
+                continue;
+            }
+            ReplyWriter writer;
+            if (showHeader) {
+                formatReplyWithHeader(&msg, writer, msg.dlc);
+            }
+            else {
+                writer.hex(msg.data, msg.dlc);
+            }
+            writer.endl();
+        }
+    } while (!uart->isMonitorExit() && driver_->getOverflows() == overflows);
+
+    if (silent) { // Restore if set
+        driver_->setSilent(false);
+    }
+    setFilterAndMask();
+    
+    AdptSendReply(uart->isMonitorExit() ? "STOPPED" : "BUFFER FULL");
+    uart->monitor(false);
+    return REPLY_OK;
+}
+
 /**
  * Test wiring connectivity for CAN
  */
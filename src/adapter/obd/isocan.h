@@ -13,27 +13,50 @@
 
 class CanDriver;
 class CanHistory;
+class ResponderSets;
 struct CanMsgBuffer;
+class ReplyWriter;
 
 const int CAN_FRAME_LEN = 8;
 
+const int ISOTP_RX_CONTEXTS = 8;
+
+// ISO 15765-2 receive state of one responder
+struct IsoTpRxContext {
+    uint32_t id;
+    bool     extended;
+    uint8_t* data;       // reassembly buffer, ATCR1 only
+    uint32_t length;
+    uint32_t pos;
+    uint32_t lastTime;   // usec, the last frame received
+    uint8_t  sn;
+    uint8_t  bs;         // block size we sent in flow control
+    uint8_t  blockCount;
+    int      frameNum;   // frame index for "n:" output
+    bool     active;
+};
+
 class IsoCanAdapter : public ProtocolAdapter {
 public:
     static const int CANSingleFrame      = 0;
     static const int CANFirstFrame       = 1;
     static const int CANConsecutiveFrame = 2;
     static const int CANFlowControlFrame = 3;
+    static const int CANFlowOverflow     = 2; // flow control status, no room to receive
 public:
     virtual int onRequest(const uint8_t* data, uint32_t len, uint32_t numOfResp);
     virtual int onConnectEcu(bool sendReply);
     virtual void setCanCAF(bool val) {}
     virtual void wiringCheck();
     virtual void dumpBuffer();
+    virtual int busMonitor(int mode, uint8_t addr);
 protected:
     IsoCanAdapter();
     virtual uint32_t getID() const = 0;
-    virtual void processFlowFrame(const CanMsgBuffer* msgBuffer) = 0;
+    virtual void processFlowFrame(const CanMsgBuffer* msgBuffer, bool overflow = false) = 0;
     bool sendToEcu(const uint8_t* data, int len);
+    bool sendMultiFrameToEcu(const uint8_t* data, int len);
+    bool sendConsecutiveFrames(const uint8_t* data, int len, int& pos, uint8_t& sn, uint8_t bs, uint8_t stmin);
     bool sendFrameToEcu(const uint8_t* data, uint8_t len, uint8_t dlc);
     bool sendFrameToEcu(const uint8_t* data, uint8_t length, uint8_t dlc, uint32_t id);
     bool receiveFromEcu(bool sendReply, uint32_t numOfResp);
@@ -41,7 +64,14 @@ protected:
     void processFrame(const CanMsgBuffer* msg);
     void processFirstFrame(const CanMsgBuffer* msg);
     void processNextFrame(const CanMsgBuffer* msg, int n);
-    void formatReplyWithHeader(const CanMsgBuffer* msg, util::string& str, int dlen);
+    IsoTpRxContext* findContext(uint32_t id);
+    IsoTpRxContext* openContext(const CanMsgBuffer* msg, uint32_t length);
+    void releaseContext(IsoTpRxContext& ctx, bool error);
+    void expireContexts(uint32_t now);
+    IsoTpRxContext* trackFrame(const CanMsgBuffer* msg, int type);
+    uint8_t getFlowBlockSize() const;
+    void sendPayload(uint32_t id, bool extended, const uint8_t* data, uint32_t length);
+    void formatReplyWithHeader(const CanMsgBuffer* msg, ReplyWriter& writer, int dlen);
     bool receiveControlFrame(uint8_t& fs, uint8_t& bs, uint8_t& stmin);
     uint32_t getP2MaxTimeout() const;
 protected:
@@ -49,6 +79,13 @@ protected:
     CanHistory* history_;
     bool        extended_;
     bool        canExtAddr_;
+    bool        reassemble_;
+    bool        learn_;       // early completion by the learned responders
+    uint32_t    requestSig_;
+    ResponderSets* responders_;
+    IsoTpRxContext rxContexts_[ISOTP_RX_CONTEXTS];
+    uint8_t*    rxArena_;
+    uint32_t    rxArenaPos_;
 };
 
 class IsoCan11Adapter : public IsoCanAdapter {
@@ -58,7 +95,7 @@ public:
     virtual void getDescriptionNum();
     virtual uint32_t getID() const;
     virtual void setFilterAndMask();
-    virtual void processFlowFrame(const CanMsgBuffer* msgBuffer);
+    virtual void processFlowFrame(const CanMsgBuffer* msgBuffer, bool overflow);
     virtual int getProtocol() const { return PROT_ISO15765_1150; }
     virtual void open();
 };
@@ -70,7 +107,7 @@ public:
     virtual void getDescriptionNum();
     virtual uint32_t getID() const;
     virtual void setFilterAndMask();
-    virtual void processFlowFrame(const CanMsgBuffer* msgBuffer);
+    virtual void processFlowFrame(const CanMsgBuffer* msgBuffer, bool overflow);
     virtual int getProtocol() const { return PROT_ISO15765_2950; }
     virtual void open();
 };
@@ -83,7 +120,7 @@ public:
     virtual void getDescription();
     virtual void getDescriptionNum();
     virtual uint32_t getID() const;
-    virtual void processFlowFrame(const CanMsgBuffer* msgBuffer) {}
+    virtual void processFlowFrame(const CanMsgBuffer* msgBuffer, bool overflow) {}
     virtual int getProtocol() const { return PROT_J1939; }
     virtual void open();
     virtual int onRequest(const uint8_t* data, uint32_t len, uint32_t numOfResp);
@@ -97,7 +134,7 @@ private:
     void processFrame(const CanMsgBuffer* msg);
     void processRtsFrame(const CanMsgBuffer* msg);
     void processDtFrame(const CanMsgBuffer* msg);
-    void formatReplyWithHeader(const CanMsgBuffer* msg, util::string& str);
+    void formatReplyWithHeader(const CanMsgBuffer* msg, ReplyWriter& writer);
     void monitorImpl(uint32_t pgn, uint32_t numOfResp);
     uint32_t getTimeout() const;
     J1939ConnectionMgr* mgr_;
@@ -13,6 +13,7 @@
 #include "canmsgbuffer.h"
 #include "isocan.h"
 #include "obdprofile.h"
+#include "respondersets.h"
 #include "timeoutmgr.h"
 
 using namespace std;
@@ -95,8 +96,10 @@ void IsoCan11Adapter::setFilterAndMask()
 
 /**
  * 11-bit CAN control frame handler implementation
+ * @param[in] msg The first frame or the last frame of the block
+ * @param[in] overflow Send FC.OVFLW instead of FC.CTS
  **/
-void IsoCan11Adapter::processFlowFrame(const CanMsgBuffer* msg)
+void IsoCan11Adapter::processFlowFrame(const CanMsgBuffer* msg, bool overflow)
 {
     if (!config_->getBoolProperty(PAR_CAN_FLOW_CONTROL))
         return; // ATCFC0
@@ -114,7 +117,11 @@ void IsoCan11Adapter::processFlowFrame(const CanMsgBuffer* msg)
         memset(ctrlData.data, CanMsgBuffer::DefaultByte, sizeof(ctrlData.data));
         memcpy(ctrlData.data, bytes->data, bytes->length);
     }
-    driver_->send(&ctrlData);
+    if (overflow) {
+        ctrlData.data[0] = (CANFlowControlFrame << 4) | CANFlowOverflow;
+        ctrlData.data[1] = ctrlData.data[2] = 0;
+    }
+    driver_->queue(&ctrlData, true); // ahead of anything queued, not waiting
     
     // Message log
     history_->add2Buffer(&ctrlData, true, 0);
@@ -134,4 +141,7 @@ void IsoCan11Adapter::open()
     
     // Reset adaptive timing
     TimeoutManager::instance()->reset();
+    
+    // Forget the responders learned on the other bus
+    responders_->clear();
 }
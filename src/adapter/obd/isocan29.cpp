@@ -13,6 +13,7 @@
 #include "canmsgbuffer.h"
 #include "isocan.h"
 #include "obdprofile.h"
+#include "respondersets.h"
 #include "timeoutmgr.h"
 
 using namespace std;
@@ -81,12 +82,15 @@ void IsoCan29Adapter::setFilterAndMask()
 
 /**
  * 29-bit CAN control frame handler implementation
+ * @param[in] msg The first frame or the last frame of the block
+ * @param[in] overflow Send FC.OVFLW instead of FC.CTS
  **/
-void IsoCan29Adapter::processFlowFrame(const CanMsgBuffer* msg)
+void IsoCan29Adapter::processFlowFrame(const CanMsgBuffer* msg, bool overflow)
 {
-    CanMsgBuffer ctrlData(0x18DA00F1, true, 8, 0x30, 0x0, 0x00);
+    uint8_t fc = (CANFlowControlFrame << 4) | (overflow ? CANFlowOverflow : 0);
+    CanMsgBuffer ctrlData(0x18DA00F1, true, 8, fc, 0x0, 0x00);
     ctrlData.id |= (msg->id & 0xFF) << 8;
-    driver_->send(&ctrlData);
+    driver_->queue(&ctrlData, true); // ahead of anything queued, not waiting
     
     // Message log
     history_->add2Buffer(&ctrlData, true, 0);
@@ -106,4 +110,7 @@ void IsoCan29Adapter::open()
     
     // Reset adaptive timing
     TimeoutManager::instance()->reset();
+    
+    // Forget the responders learned on the other bus
+    responders_->clear();
 }
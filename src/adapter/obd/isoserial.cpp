@@ -13,6 +13,7 @@
 #include <EcuUart.h>
 #include "j1979.h"
 #include "isoserial.h"
+#include "p4cache.h"
 #include "timeoutmgr.h"
 
 using namespace std;
@@ -21,6 +22,8 @@ using namespace util;
 static const uint8_t Iso14230Seq[]    = { 0x81 };
 static const uint8_t Iso9141Wakeup[]  = { 0x01, 0x00 };
 static const uint8_t Iso14230Wakeup[] = { 0x3E };
+static const uint8_t P4ProbeSeq[]     = { 0x01, 0x00 };
+static const uint8_t ReadTimingLimits[] = { 0x83, 0x00 };
 
 #define __BELLS_AND_WHISTLES__
 #ifdef __BELLS_AND_WHISTLES__
@@ -75,7 +78,7 @@ void IsoSerialAdapter::setKeepAlive()
     if (wakeupTime) { // If keepalive enabled?
         keepAliveTimer_->start(wakeupTime);
     }
-    p3Timer_->start(P3_MIN_TIMEOUT);
+    p3Timer_->start(p3Time_);
 }
 
 bool IsoSerialAdapter::isKeepAlive()
@@ -95,6 +98,14 @@ IsoSerialAdapter::IsoSerialAdapter()
     keepAliveTimer_ =  LongTimer::instance();
     p3Timer_        =  Timer::instance(1);
     sts_            =  REPLY_NO_DATA;
+    slowInitStarted_ =  false;
+    txPending_      =  false;
+    p4Time_         =  P4_TIMEOUT * 1000;
+    p4Default_      =  true;
+    p3Time_         =  P3_MIN_TIMEOUT;
+    p2Max_          =  0;
+    speed_          =  ECU_SPEED;
+    p4Cache_        =  new P4Cache();
 }
 
 /**
@@ -102,7 +113,16 @@ IsoSerialAdapter::IsoSerialAdapter()
  */
 void IsoSerialAdapter::open()
 {
-    uart_->init(ECU_SPEED);
+    // ATIB, 10400 if not set
+    uint32_t speed = config_->getIntProperty(PAR_ISO_BAUDRATE);
+    speed_ = speed ? speed : ECU_SPEED;
+    uart_->init(speed_);
+    p4Time_ = P4_TIMEOUT * 1000 * ECU_SPEED / speed_;
+    p4Default_ = true;
+    
+    // Drop the timing negotiated with the previous ECU
+    p3Time_ = P3_MIN_TIMEOUT;
+    p2Max_ = 0;
     
     // Reset adaptive timing
     TimeoutManager::instance()->reset();
@@ -135,72 +155,97 @@ void IsoSerialAdapter::setProtocol(int protocol)
 }
 
 /**
- * Transmits a sequence of bytes to the ECU 
+ * Start transmitting a sequence of bytes to the ECU, the bytes are timed by
+ * EcuUart interrupts. The transmit status is checked by receiveFromEcu()
  * @param[in] msg Ecumsg instance
- * @param[in] p4timeout The P4 timeout
- * @return true if ok, false if wiring problems
+ * @param[in] p4Time The P4 interbyte time, us
+ * @return true if started, false otherwise
  */
-bool IsoSerialAdapter::sendToEcu(const Ecumsg* msg, int p4Timeout)
+bool IsoSerialAdapter::sendToEcu(const Ecumsg* msg, uint32_t p4Time)
 {
     appendToHistory(msg); // Buffer dump
     
     TX_LED(1); // Turn the transmit LED on
+    
+    uart_->flush(); // Anything received late is no use now
+    
+    txPending_ = uart_->send(msg->data(), msg->length(), p4Time);
+    if (!txPending_) {
+        TX_LED(0);
+    }
+    return txPending_;
+}
 
-    for (int i = 0; i < msg->length(); i++) {
-        uart_->send(msg->data()[i]);
-        
-        // Get the echo byte, it takes 1.2ms
-        if (!uart_->getEcho(msg->data()[i])) {
-            TX_LED(0); // Turn the transmit LED off
-            return false;
-        }    
-        // Interbyte delay <P4 = [5-20ms]>
-        if (i < (msg->length() - 1)) {
-            Delay1ms(p4Timeout);
-        } 
-    } 
-
+/**
+ * Wait for the last byte echo of the message being sent
+ * @return true if ok, false if wiring problems or collision
+ */
+bool IsoSerialAdapter::waitTxDone()
+{
+    while (uart_->isSending())
+        ;
+    
     TX_LED(0); // Turn the transmit LED off
-    return true;
+    return uart_->txStatus() == EcuUart::TX_OK;
 }
 
 /**
  * Receives a sequence of bytes from the ECU until timeout expired or 
- * the maximum number of bytes received
+ * the maximum number of bytes received. Right after sendToEcu() the P2 timeout
+ * starts with the last byte sent, nothing is received if the transmit failed
  * @param[in] msg Ecumsg instance
  * @param[in] maxLen The maximum bytes to receive
  * @param[in] p2timeout The P2 timeout
  * @param[in] p1timeout The P1 timeout
+ * @param[in] measure Take the P2 sample, for the first response right after the request only
  */
-void IsoSerialAdapter::receiveFromEcu(Ecumsg* msg, int maxLen, int p2Timeout, int p1Timeout)
+void IsoSerialAdapter::receiveFromEcu(Ecumsg* msg, int maxLen, int p2Timeout, int p1Timeout, bool measure)
 {
     msg->length(0);
     
-    // Set the req/reply operation timeout
-    Timer* timer = Timer::instance(1);
-    timer->start(p2Timeout);
+    // The gaps are measured with the byte receive timestamps, us
+    MicroTimer* clock = MicroTimer::instance();
+    uint32_t start = clock->value();
+    if (txPending_) {
+        txPending_ = false;
+        if (!waitTxDone())
+            return;
+        start = uart_->txEndTime();
+    }
+    uint32_t last = start;
+    int32_t timeout = p2Timeout * 1000;
+    int32_t p2 = 0;
     
-    for(int i = 0; i < maxLen; i++) { // Only retrieve maxLen bytes
-        // Wait for data to be received
-        while(!uart_->ready()) {
-            if (timer->isExpired())
-                goto extm; // exit by timeout
+    while (msg->length() < maxLen) { // Only retrieve maxLen bytes
+        uint32_t time;
+        if (!uart_->getTime(time)) {
+            if (int32_t(clock->value() - last) > timeout)
+                break; // exit by timeout
+            continue;
         }
-
-        (*msg) += uart_->get();
+        if (int32_t(time - last) > timeout)
+            break;     // the gap expired before the byte, it is the next message
         
-        if (i == 0) { // Measure the response time
-            TimeoutManager::instance()->p2Timeout(timer->value());
+        if (msg->length() == 0) { // The response time
+            p2 = int32_t(time - start);
         }
+        (*msg) += uart_->get();
         
         RX_LED(1); // Turn the receive LED on
 
-        // Reload the timer with P1 timeout
-        timer->start(p1Timeout);
+        // The P1 interbyte gap from now on
+        if (int32_t(time - last) > 0) {
+            last = time;
+        }
+        timeout = p1Timeout * 1000;
     }
-extm:
     RX_LED(0); // Turn the receive LED off
     appendToHistory(msg); // Buffer dump
+    
+    // The responder address is the header source byte
+    if (measure && msg->length() >= 3) {
+        TimeoutManager::instance()->p2Timeout(p2 > 0 ? (p2 / 1000) : 0, msg->data()[2]);
+    }
 }
 
 /**
@@ -209,37 +254,62 @@ extm:
  */
 bool IsoSerialAdapter::ecuSlowInit() 
 {
-    // Sending 0x33 at 5bps
-    const int BIT_INTERVAL = 200; // 200ms
-    bool sts = true;
-
-    TX_LED(1); // Turn the transmit LED on
-
-    // Disable USART
-    uart_->setBitBang(true);
-
-    uint16_t ch = isoInitByte_;
-    ch <<= 1;    // Shift to accommodate start bit
-    ch |= 0x200; // Add stop bit
-
-    for (int i = 0; i < 10; i++) {
-        uint8_t val = (ch & 0x01);
-        uart_->setBit(val);
-        Delay1ms(BIT_INTERVAL);
-        ch >>= 1;
+    // Sending 0x33 at 5bps, unless started already
+    if (!slowInitStarted_) {
+        TX_LED(1); // Turn the transmit LED on
+        uart_->startSlowInit(isoInitByte_);
     }
+    slowInitStarted_ = false;
+    
+    while (!uart_->isSlowInitDone())
+        ;
 
     TX_LED(0); // Turn the transmit LED off
+    
+    // The last bit (stop bit) status
+    return uart_->slowInitStatus();
+}
 
-    // Get the feedback status, the last bit (stop bit)
-    if (!uart_->getBit()) {
-        sts = false;   // Wiring error, no +12V power?
-    }
+/**
+ * Start the slow 5bps init in the background, so the other protocols
+ * could be probed meanwhile. The connect sequence is completed by onConnectEcu.
+ * @return true if started, false if the protocol does not use slow init
+ */
+bool IsoSerialAdapter::startSlowInit()
+{
+    if (connected_ || slowInitStarted_)
+        return false;
     
-    // Enable USART
-    uart_->setBitBang(false);
+    configureProperties();
+    if (protocol_ != PROT_AUTO && protocol_ != PROT_ISO9141 && protocol_ != PROT_ISO14230_5BPS)
+        return false;
     
-    return sts;
+    open();
+    TX_LED(1); // Turn the transmit LED on
+    uart_->startSlowInit(isoInitByte_);
+    slowInitStarted_ = true;
+    return true;
+}
+
+/**
+ * Abort the background slow init, another protocol detected
+ */
+void IsoSerialAdapter::stopSlowInit()
+{
+    if (!slowInitStarted_)
+        return;
+    uart_->stopSlowInit();
+    slowInitStarted_ = false;
+    TX_LED(0); // Turn the transmit LED off
+}
+
+/**
+ * The time left for the background slow init
+ * @return The remaining time in ms
+ */
+uint32_t IsoSerialAdapter::slowInitRemaining() const
+{
+    return slowInitStarted_ ? uart_->slowInitRemaining() : 0;
 }
 
 /**
@@ -302,12 +372,14 @@ int IsoSerialAdapter::onConnectEcuSlow(int protocol)
     // Send inverted last byte
     msg->data()[0] = ~msg->data()[2]; 
     msg->length(1);
-    if (!sendToEcu(msg.get(), P4_TIMEOUT))
+    if (!sendToEcu(msg.get(), p4Time_))
         return REPLY_WIRING_ERROR;
 
     // Should wait for "0xcc" and use timeout <W4 = [25-50ms]>
     // Note: providing 2-nd timeout as placeholder, its not being used as we are waiting for one byte
     receiveFromEcu(msg.get(), 1, W4_MAX_TIMEOUT, W3_TIMEOUT); 
+    if (uart_->txStatus() != EcuUart::TX_OK)
+        return REPLY_WIRING_ERROR;
     if (msg->length() == 0) {
         return REPLY_ERROR;
     }        
@@ -410,7 +482,8 @@ int IsoSerialAdapter::onConnectEcuFast(int protocol)
     }
 #endif
 
-    // Send wakeup pattern at 10400 bit/s
+    // Send wakeup pattern at 10400 bit/s, no matter ATIB
+    setSpeed(ECU_SPEED);
     if (!ecuFastInit())
         return REPLY_WIRING_ERROR;
 
@@ -418,11 +491,13 @@ int IsoSerialAdapter::onConnectEcuFast(int protocol)
     msg->addHeaderAndChecksum();
     
     uart_->clear(); // clear error flags
-    if (!sendToEcu(msg.get(), P4_TIMEOUT))
+    if (!sendToEcu(msg.get(), p4Time_))
         return REPLY_WIRING_ERROR;
 
     for (;;) {
-        receiveFromEcu(msg.get(), maxLen, p2Timeout, P1_MAX_TIMEOUT);
+        receiveFromEcu(msg.get(), maxLen, p2Timeout, getP1MaxTimeout());
+        if (uart_->txStatus() != EcuUart::TX_OK)
+            return REPLY_WIRING_ERROR;
         if (msg->length() == 0)
             break;
         if (connected_)
@@ -506,14 +581,14 @@ void IsoSerialAdapter::sendHeartBeat()
     }
 
     uart_->clear(); // clear error flags
-    if (!sendToEcu(msg.get(), P4_TIMEOUT)) {
+    if (!sendToEcu(msg.get(), p4Time_)) {
         setKeepAlive(); 
         return; // Beat failed, K line is busy
     }
 
     // Wait for multiply replies
     for (int i = 0; ; i++) {            
-        receiveFromEcu(msg.get(), OBD_OUT_MSG_LEN, p2Timeout, P1_MAX_TIMEOUT);
+        receiveFromEcu(msg.get(), OBD_OUT_MSG_LEN, p2Timeout, getP1MaxTimeout());
         if (msg->length() == 0) {
             break; // Timeout
         }
@@ -565,17 +640,30 @@ int IsoSerialAdapter::onRequest(const uint8_t* data, uint32_t len, uint32_t numO
     checkP3Timeout();
     
     uart_->clear(); // clear error flags
-    if (!sendToEcu(msg.get(), P4_TIMEOUT)) {
+    if (!sendToEcu(msg.get(), p4Time_)) {
         return REPLY_WIRING_ERROR;
     }
 
-    // Wait for multiple replies
+    // StartDiagnosticSession with the baud rate parameter, the high speed KWP2000
+    // might follow. The session without it, like "10 81", keeps the rate
+    uint32_t kwpSpeed = config_->getIntProperty(PAR_KWP_SPEED);
+    bool startSession = (kwpSpeed != 0) && (msgtype == Ecumsg::ISO14230) && (data[0] == 0x10) && (len >= 3);
+    bool switchSpeed = false;
+
+    // Wait for multiple replies, the first one is measured from the request end
     for (uint32_t num = 0; num < numOfResp; ) {
-        receiveFromEcu(msg.get(), maxLen, p2Timeout, P1_MAX_TIMEOUT); 
+        receiveFromEcu(msg.get(), maxLen, p2Timeout, getP1MaxTimeout(), num == 0); 
+        if (uart_->txStatus() != EcuUart::TX_OK)
+            return REPLY_WIRING_ERROR;
         if (msg->length() == 0)
             break;
         if (msg->length() < 5)
             return REPLY_DATA_ERROR;
+        
+        // Positive response to StartDiagnosticSession
+        if (startSession && msg->data()[msg->headerLength()] == 0x50) {
+            switchSpeed = true;
+        }
             
         if (!checkResponsePending(msg.get()) || pendRespCounter > MAX_PEND_RESP_NUM) {
             p2Timeout = getP2MaxTimeout();
@@ -599,6 +687,9 @@ int IsoSerialAdapter::onRequest(const uint8_t* data, uint32_t len, uint32_t numO
         msg->sendReply();
     }
 
+    if (switchSpeed) {
+        setSpeed(kwpSpeed);
+    }
     setKeepAlive();
     
     // Do we have at least one reply?    
@@ -671,9 +762,11 @@ int IsoSerialAdapter::onConnectEcu(bool sendReply)
         return protocol_;
     }
     
-    // Set speed and etc
-    configureProperties(); 
-    open();
+    // Set speed and etc, done already if the slow init is running
+    if (!slowInitStarted_) {
+        configureProperties(); 
+        open();
+    }
 
     int requestedProtocol = protocol_;
     int connectStatus = 0;
@@ -698,6 +791,14 @@ int IsoSerialAdapter::onConnectEcu(bool sendReply)
     }
 
     if (connected_) {
+        bool negotiated = false;
+        if (config_->getBoolProperty(PAR_KWP_TIMING) && 
+              (protocol_ == PROT_ISO14230 || protocol_ == PROT_ISO14230_5BPS)) {
+            negotiated = accessTiming();
+        }
+        if (!negotiated && config_->getBoolProperty(PAR_KLINE_TUNE)) {
+            tuneP4();
+        }
         #ifdef __BELLS_AND_WHISTLES__
         if (requestedProtocol != PROT_AUTO) {
             AdptSendReply(EchoOk);
@@ -711,6 +812,139 @@ int IsoSerialAdapter::onConnectEcu(bool sendReply)
     return connected_ ? protocol_ : 0;
 }
 
+/**
+ * Find the shortest P4 the ECU accepts, probing with "01 00" request.
+ * The calibrated value is cached per ECU address, keywords and baud rate,
+ * the cached value is confirmed with one probe before use.
+ */
+void IsoSerialAdapter::tuneP4()
+{
+    const uint32_t P4Steps[] = { 5000, 3000, 2000, 1000, 500, 0 }; // us
+    const int PROBE_TRIES = 2;
+    
+    // The key is shared by many ECUs, confirm the cached value first
+    uint32_t p4Time = p4Cache_->find(isoInitByte_, isoKwrds_[0], isoKwrds_[1], speed_);
+    if (p4Time != P4Cache::NOT_FOUND && probeP4(p4Time)) {
+        p4Time_ = p4Time;
+        p4Default_ = false;
+        return;
+    }
+    
+    bool tuned = false;
+    for (uint32_t step : P4Steps) {
+        bool sts = true;
+        for (int i = 0; i < PROBE_TRIES && sts; i++) {
+            sts = probeP4(step);
+        }
+        if (!sts)
+            break; // The last one is the shortest reliable
+        p4Time = step;
+        tuned = true;
+    }
+    
+    // Keep the default P4 and try again next time if nothing worked,
+    // the entry found is overwritten with the new value otherwise
+    if (tuned) {
+        p4Time_ = p4Time;
+        p4Default_ = false;
+        p4Cache_->store(isoInitByte_, isoKwrds_[0], isoKwrds_[1], speed_, p4Time);
+    }
+}
+
+/**
+ * Send the probe request with the given P4
+ * @param[in] p4Time The P4 time, us
+ * @return true if the positive response received, false otherwise
+ */
+bool IsoSerialAdapter::probeP4(uint32_t p4Time)
+{
+    uint32_t len = 0;
+    return exchange(P4ProbeSeq, sizeof(P4ProbeSeq), p4Time, nullptr, len);
+}
+
+/**
+ * Negotiate the KWP2000 timing with AccessTimingParameters service,
+ * read the limits of possible timing and ask for the tightest ones
+ * @return true if the ECU accepted the new timing, false otherwise
+ */
+bool IsoSerialAdapter::accessTiming()
+{
+    const uint32_t P2_MAX_EXTENDED = 0xF0;
+    const uint32_t P2_MAX_RES = 50; // P2max resolution in P2min units, 25ms
+    uint8_t reply[7];
+    uint32_t len = sizeof(reply);
+    
+    // C3 00 P2min P2max P3min P3max P4min, readLimitsOfPossibleTimingParameters
+    if (!exchange(ReadTimingLimits, sizeof(ReadTimingLimits), p4Time_, reply, len) || len < 7 || reply[1] != 0x00)
+        return false;
+
+    // The minimums as they are, P2max is the first 25ms step above P2min
+    // within the ECU limit, P3max limit is kept
+    uint8_t p2min = reply[2];
+    uint32_t p2max = p2min / P2_MAX_RES + 1;
+    if (reply[3] && reply[3] <= P2_MAX_EXTENDED && p2max > reply[3]) {
+        p2max = reply[3];
+    }
+    uint8_t request[] = { 0x83, 0x03, p2min, static_cast<uint8_t>(p2max), reply[4], reply[5], reply[6] };
+    len = sizeof(reply);
+    if (!exchange(request, sizeof(request), p4Time_, reply, len))
+        return false;
+
+    // P2max is 25 ms per bit
+    p2Max_ = request[3] ? request[3] * 25 : 0;
+    
+    // P3min and P4min are 0.5 ms per bit, the P3 timer runs in ms
+    p3Time_ = (request[4] + 1) / 2;
+    if (p3Time_ == 0) {
+        p3Time_ = 1;
+    }
+    p4Time_ = request[6] * 500;
+    p4Default_ = false;
+    setKeepAlive();
+    return true;
+}
+
+/**
+ * Send the request and collect all the responses, for internal use
+ * @param[in] data The request bytes, no header
+ * @param[in] len The request length
+ * @param[in] p4Time The P4 time, us
+ * @param[out] reply The positive response bytes, no header, could be nullptr
+ * @param[in,out] replyLen The reply buffer length, the positive response length
+ * @return true if the positive response received, false otherwise
+ */
+bool IsoSerialAdapter::exchange(const uint8_t* data, uint32_t len, uint32_t p4Time,
+                                uint8_t* reply, uint32_t& replyLen)
+{
+    bool sts = false;
+    uint8_t msgtype = (protocol_ == PROT_ISO14230 || protocol_ == PROT_ISO14230_5BPS)
+                    ? Ecumsg::ISO14230 : Ecumsg::ISO9141;
+    unique_ptr<Ecumsg> msg(Ecumsg::instance(msgtype));
+    
+    msg->setData(data, len);
+    msg->addHeaderAndChecksum();
+    
+    checkP3Timeout();
+    if (sendToEcu(msg.get(), p4Time)) {
+        for (;;) {
+            receiveFromEcu(msg.get(), get2MaxLen(), getP2MaxTimeout(), getP1MaxTimeout());
+            if (msg->length() == 0)
+                break;
+            if (sts || msg->length() < 5 || !msg->stripHeaderAndChecksum())
+                continue;
+            if (msg->data()[0] == (data[0] | 0x40)) {
+                sts = true;
+                if (reply) {
+                    replyLen = min(replyLen, static_cast<uint32_t>(msg->length()));
+                    memcpy(reply, msg->data(), replyLen);
+                }
+            }
+        }
+    }
+    setKeepAlive();
+    return sts;
+}
+
 /**
  * Test wiring connectivity for ISO 9141/14230
  */
@@ -750,7 +984,41 @@ ext:
  */
 uint32_t IsoSerialAdapter::getP2MaxTimeout() const
 {
-    return TimeoutManager::instance()->p2Timeout();
+    const uint32_t P2_MARGIN = 5;
+    uint32_t timeout = TimeoutManager::instance()->p2Timeout();
+    
+    // Never wait longer than the ECU has agreed to answer in
+    if (p2Max_ && (p2Max_ + P2_MARGIN) < timeout) {
+        timeout = p2Max_ + P2_MARGIN;
+    }
+    return timeout;
+}
+
+/**
+ * The P1 interbyte timeout, scaled with the baud rate
+ * @return The timeout value, ms
+ */
+uint32_t IsoSerialAdapter::getP1MaxTimeout() const
+{
+    const uint32_t P1_MIN_TIMEOUT = 2;
+    uint32_t timeout = P1_MAX_TIMEOUT * ECU_SPEED / speed_;
+    return timeout > P1_MIN_TIMEOUT ? timeout : P1_MIN_TIMEOUT;
+}
+
+/**
+ * Switch the K-line baud rate, scale the default P4 with it. The calibrated
+ * or negotiated P4 is the ECU minimum and stays as it is
+ * @param[in] speed The baud rate
+ */
+void IsoSerialAdapter::setSpeed(uint32_t speed)
+{
+    if (speed == speed_)
+        return;
+    if (p4Default_) {
+        p4Time_ = P4_TIMEOUT * 1000 * ECU_SPEED / speed;
+    }
+    speed_ = speed;
+    uart_->init(speed_);
 }
 
 /**
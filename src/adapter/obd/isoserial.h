@@ -1,7 +1,7 @@
 /**
  * See the file LICENSE for redistribution information.
  *
- * Copyright (c) 2009-2016 ObdDiag.Net. All rights reserved.
+ * Copyright (c) 2009-2018 ObdDiag.Net. All rights reserved.
  *
  */
 
@@ -16,6 +16,7 @@ static const int ECU_SPEED = 10400;
 class EcuUart;
 class Timer;
 class LongTimer;
+class P4Cache;
 
 class IsoSerialAdapter : public ProtocolAdapter {
 public:
@@ -32,6 +33,9 @@ public:
     virtual void sendHeartBeat();
     virtual int getProtocol() const { return protocol_; }
     virtual void kwDisplay();
+    bool startSlowInit();
+    void stopSlowInit();
+    uint32_t slowInitRemaining() const;
 private:
     IsoSerialAdapter();
     bool ecuSlowInit();
@@ -39,16 +43,31 @@ private:
     void setKeepAlive();
     void checkP3Timeout();
     bool isKeepAlive();
-    bool sendToEcu(const Ecumsg* msg, int p4Timeout);
-    void receiveFromEcu(Ecumsg* msg, int maxLen, int p2Timeout, int p1Timeout);
+    bool sendToEcu(const Ecumsg* msg, uint32_t p4Time);
+    bool waitTxDone();
+    void receiveFromEcu(Ecumsg* msg, int maxLen, int p2Timeout, int p1Timeout, bool measure = false);
     bool checkResponsePending(const Ecumsg* msg);
     void configureProperties();
     int  onConnectEcuSlow(int protocol);
     int  onConnectEcuFast(int protocol);
+    void tuneP4();
+    bool probeP4(uint32_t p4Time);
+    bool accessTiming();
+    bool exchange(const uint8_t* data, uint32_t len, uint32_t p4Time, uint8_t* reply, uint32_t& replyLen);
     uint32_t get2MaxLen() const;
     uint32_t getP2MaxTimeout() const;
+    uint32_t getP1MaxTimeout() const;
+    void setSpeed(uint32_t speed);
     uint32_t getWakeupTime() const; 
     bool     kwCheck_;
+    bool     slowInitStarted_;
+    bool     txPending_; // sent, the status is not checked yet
+    bool     p4Default_; // P4 is the ISO default, scaled with the baud rate
+    uint32_t p4Time_;  // P4 interbyte time, us
+    uint32_t p3Time_;  // P3 min time between the requests, ms
+    uint32_t p2Max_;   // P2 max negotiated with the ECU, ms, 0 if none
+    uint32_t speed_;
+    P4Cache* p4Cache_;
     uint8_t  isoKwrds_[2];
     int      protocol_;
     uint8_t  isoInitByte_;
@@ -5,13 +5,14 @@
  *
  */
 
-#include <cstdio>
 #include <adaptertypes.h>
 #include <algorithms.h>
 #include <Timer.h>
 #include <CmdUart.h>
 #include <CanDriver.h>
 #include <led.h>
+#include <replywriter.h>
+#include <binarylink.h>
 #include "canhistory.h"
 #include "canmsgbuffer.h"
 #include "isocan.h"
@@ -230,15 +231,19 @@ void J1939Adapter::setFilterAndMaskForPGN(uint32_t pgn)
  */
 void J1939Adapter::processFrame(const CanMsgBuffer* msg)
 {
-    util::string str;
+    if (BinaryLink::isActive()) {
+        BinaryLink::instance()->sendMessage(msg);
+        return;
+    }
+    ReplyWriter writer;
     
     if (config_->getBoolProperty(PAR_HEADER_SHOW)) {
-        formatReplyWithHeader(msg, str);
+        formatReplyWithHeader(msg, writer);
     }
     else {
-        to_ascii(msg->data, msg->dlc, str);
+        writer.hex(msg->data, msg->dlc);
     }
-    AdptSendReply(str);
+    writer.endl();
 }
 
 /**
@@ -247,10 +252,13 @@ void J1939Adapter::processFrame(const CanMsgBuffer* msg)
  */
 void J1939Adapter::processRtsFrame(const CanMsgBuffer* msg)
 {
-    const int STR_LEN = 4;
-    char slen[STR_LEN];
-    sprintf(slen, "%.3X", static_cast<unsigned>(mgr_->size()));
-    AdptSendReply(slen);
+    if (BinaryLink::isActive()) // the data frames carry everything
+        return;
+    ReplyWriter writer;
+    uint32_t size = mgr_->size();
+    writer.nibble(size >> 8); // 3 digits length
+    writer.hex(size & 0xFF);
+    writer.endl();
 }
 
 /**
@@ -259,58 +267,56 @@ void J1939Adapter::processRtsFrame(const CanMsgBuffer* msg)
  */
 void J1939Adapter::processDtFrame(const CanMsgBuffer* msg)
 {
-    util::string str;
+    if (BinaryLink::isActive()) {
+        BinaryLink::instance()->sendMessage(msg);
+        return;
+    }
+    ReplyWriter writer;
     
     if (config_->getBoolProperty(PAR_HEADER_SHOW)) {
-        formatReplyWithHeader(msg, str);
+        formatReplyWithHeader(msg, writer);
     }
     else {
-        const int STR_LEN = 5;
-        char prefix[STR_LEN];
-        sprintf(prefix, "%.2X: ", static_cast<unsigned>(msg->data[0]));
-        str = prefix;
-        to_ascii(msg->data + 1, msg->dlc - 1, str);
+        writer.hex(msg->data[0]);
+        writer.put(": ");
+        writer.hex(msg->data + 1, msg->dlc - 1);
     }
-    AdptSendReply(str);
+    writer.endl();
 }
 
 /**
  * Format reply for "H1/JHF" options
  * @param[in] msg CanMsgbuffer instance pointer
- * @param[out] str The output string
+ * @param[out] writer The reply writer
  */
-void J1939Adapter::formatReplyWithHeader(const CanMsgBuffer* msg, util::string& str)
+void J1939Adapter::formatReplyWithHeader(const CanMsgBuffer* msg, ReplyWriter& writer)
 {
-    Spacer spacer(str);
     bool jhf0 = AdapterConfig::instance()->getBoolProperty(PAR_J1939_HEADER);
     
     if (jhf0) {
         // CAN Priority byte
         uint8_t priority = (msg->id & 0x1C000000) >> 26;
-        str += to_ascii(priority);
-        spacer.space();
+        writer.nibble(priority);
+        writer.space();
         
         // J1939 PGN
         uint32_t pgn = (msg->id & 0x03FFFF00) >> 8;
-        str += to_ascii((pgn & 0x30000) >> 16);
-        str += to_ascii((pgn & 0x0F000) >> 12);
-        str += to_ascii((pgn & 0x00F00) >> 8);
-        str += to_ascii((pgn & 0x000F0) >> 4);
-        str += to_ascii(pgn & 0x0000F);
-        spacer.space();
+        writer.nibble(pgn >> 16);
+        writer.hex((pgn >> 8) & 0xFF);
+        writer.hex(pgn & 0xFF);
+        writer.space();
         
         // Source address
         uint8_t sa = msg->id & 0x000000FF;
-        str += to_ascii((sa & 0xF0) >> 4);
-        str += to_ascii(sa & 0x0F);
+        writer.hex(sa);
     }
     else {
-        CanIDToString(msg->id, str, true);
+        writer.canId(msg->id, true);
     }
-    spacer.space();
+    writer.space();
     
     // The frame data
-    to_ascii(msg->data, msg->dlc, str);
+    writer.hex(msg->data, msg->dlc);
 }
 
 /**
@@ -7,6 +7,7 @@
 
 #include <algorithms.h>
 #include "obdprofile.h"
+#include "binarylink.h"
 #include "datacollector.h"
 
 using namespace util;
@@ -124,9 +125,12 @@ int OBDProfile::setProtocol(int num, bool refreshConnection)
  * @param[in] collector The command
  * @return The status code
  */
-void OBDProfile::onRequest(const DataCollector* collector)
+int OBDProfile::onRequest(const DataCollector* collector)
 {
     int result = onRequestImpl(collector);
+    if (BinaryLink::isActive()) // the status frame carries the result
+        return result;
+    
     switch(result) {
         case REPLY_CMD_WRONG:
             AdptSendReply(ErrMessage);
@@ -161,7 +165,8 @@ void OBDProfile::onRequest(const DataCollector* collector)
             AdptSendReply(Err0Message);
             break;
     }
-}    
+    return result;
+}
 
 /**
  * The number of frames parameter parser
@@ -229,6 +234,9 @@ int OBDProfile::onRequestImpl(const DataCollector* collector)
     }
     if (protocol) {
         setProtocol(protocol, false);
+        if (AdapterConfig::instance()->getBoolProperty(PAR_MEMORY)) {
+            AdapterConfig::instance()->storeProtocol(true, protocol);
+        }
         if (!sendReply || (protocol >= PROT_ISO9141 && protocol <= PROT_ISO14230)) {
             sts = adapter_->onRequest(collector->getData(), collector->getLength(), numOfResp);
         }
@@ -256,6 +264,10 @@ bool OBDProfile::sendLengthCheck(int len)
     else if (adapter_ ==  ProtocolAdapter::getAdapter(ADPTR_VPW)) {
         maxLen = J1850_IN_MSG_DLEN; // For VPW use max length
     }
+    else if (adapter_ ==  ProtocolAdapter::getAdapter(ADPTR_CAN) ||
+             adapter_ ==  ProtocolAdapter::getAdapter(ADPTR_CAN_EXT)) {
+        maxLen = ISOTP_MAX_DLEN; // Segmented transmit
+    }
 
     if ((len == 0) ||len > maxLen) {
         return false;
@@ -340,3 +352,14 @@ void OBDProfile::monitor(const string& cmdString)
 
     adapter_->monitor(data, len, numOfResp);
 }
+
+/**
+ * Pass to CAN layer for ATMA/ATMR/ATMT monitoring
+ * @param[in] mode The monitor mode
+ * @param[in] addr The receiver/transmitter address
+ * @return The completion status
+ */
+int OBDProfile::busMonitor(int mode, uint8_t addr)
+{
+    return adapter_->busMonitor(mode, addr);
+}
@@ -24,13 +24,14 @@ public:
     void sendHeartBeat();
     void dumpBuffer();
     void closeProtocol();
-    void onRequest(const DataCollector* collector);
+    int onRequest(const DataCollector* collector);
     int getProtocol() const;
     void wiringCheck();
     int kwDisplay();
     void setFilterAndMask();
     void monitor();
     void monitor(const util::string& cmdString);
+    int busMonitor(int mode, uint8_t addr);
 private:
     bool sendLengthCheck(int len);
     int onRequestImpl(const DataCollector* collector);
@@ -0,0 +1,101 @@
+/**
+ * See the file LICENSE for redistribution information.
+ *
+ * Copyright (c) 2009-2018 ObdDiag.Net. All rights reserved.
+ *
+ */
+
+#include <cstring>
+#include <EepromDriver.h>
+#include <crc16.h>
+#include <adaptertypes.h>
+#include "p4cache.h"
+
+using namespace util;
+
+const uint16_t P4_CACHE_MAGIC = 0xA54D;
+
+/**
+ * Read the cache from EEPROM, start empty if not valid
+ */
+void P4Cache::load()
+{
+    loaded_ = true;
+    uint8_t* data = reinterpret_cast<uint8_t*>(&cache_);
+    if (EepromDriver::read(EEPROM_P4_CACHE_ADDR, data, sizeof(StoredCache)) &&
+        cache_.magic == P4_CACHE_MAGIC &&
+        cache_.crc == crc16(data, sizeof(StoredCache) - sizeof(cache_.crc))) {
+        return;
+    }
+    memset(&cache_, 0, sizeof(StoredCache));
+    cache_.magic = P4_CACHE_MAGIC;
+}
+
+/**
+ * Find the entry index
+ * @param[in] addr The ECU address
+ * @param[in] kb1 The keyword 1
+ * @param[in] kb2 The keyword 2
+ * @param[in] rate The baud rate / 100
+ * @return The entry index, -1 if not found
+ */
+int P4Cache::lookup(uint8_t addr, uint8_t kb1, uint8_t kb2, uint16_t rate) const
+{
+    for (int i = 0; i < MAX_ENTRIES; i++) {
+        const Entry& entry = cache_.entries[i];
+        if (entry.valid && entry.addr == addr && entry.kb1 == kb1 && entry.kb2 == kb2 && entry.rate == rate)
+            return i;
+    }
+    return -1;
+}
+
+/**
+ * Find the calibrated P4
+ * @param[in] addr The ECU address
+ * @param[in] kb1 The keyword 1
+ * @param[in] kb2 The keyword 2
+ * @param[in] speed The baud rate the P4 is used with
+ * @return The P4 time in us, NOT_FOUND if not calibrated yet
+ */
+uint32_t P4Cache::find(uint8_t addr, uint8_t kb1, uint8_t kb2, uint32_t speed)
+{
+    if (!loaded_) {
+        load();
+    }
+    int idx = lookup(addr, kb1, kb2, speed / 100);
+    return (idx >= 0) ? cache_.entries[idx].p4Time : NOT_FOUND;
+}
+
+/**
+ * Store the calibrated P4 and write the cache to EEPROM
+ * @param[in] addr The ECU address
+ * @param[in] kb1 The keyword 1
+ * @param[in] kb2 The keyword 2
+ * @param[in] speed The baud rate the P4 is calibrated with
+ * @param[in] p4Time The P4 time in us
+ */
+void P4Cache::store(uint8_t addr, uint8_t kb1, uint8_t kb2, uint32_t speed, uint32_t p4Time)
+{
+    if (!loaded_) {
+        load();
+    }
+    
+    uint16_t rate = speed / 100;
+    int idx = lookup(addr, kb1, kb2, rate);
+    if (idx < 0) {
+        idx = cache_.next;
+        cache_.next = (cache_.next + 1) % MAX_ENTRIES;
+    }
+    
+    Entry& entry = cache_.entries[idx];
+    entry.addr = addr;
+    entry.kb1 = kb1;
+    entry.kb2 = kb2;
+    entry.valid = 1;
+    entry.p4Time = p4Time;
+    entry.rate = rate;
+    
+    uint8_t* data = reinterpret_cast<uint8_t*>(&cache_);
+    cache_.crc = crc16(data, sizeof(StoredCache) - sizeof(cache_.crc));
+    EepromDriver::write(EEPROM_P4_CACHE_ADDR, data, sizeof(StoredCache));
+}
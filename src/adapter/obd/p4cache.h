@@ -0,0 +1,47 @@
+/**
+ * See the file LICENSE for redistribution information.
+ *
+ * Copyright (c) 2009-2018 ObdDiag.Net. All rights reserved.
+ *
+ */
+
+#ifndef __P4_CACHE_H__
+#define __P4_CACHE_H__
+
+#include <cstdint>
+
+using namespace std;
+
+// The calibrated P4 interbyte time per ECU address, keyword pair and baud rate, kept in EEPROM
+//
+class P4Cache {
+public:
+    const static int MAX_ENTRIES = 8;
+    const static uint32_t NOT_FOUND = 0xFFFFFFFF;
+    
+    P4Cache() : loaded_(false) {}
+    uint32_t find(uint8_t addr, uint8_t kb1, uint8_t kb2, uint32_t speed);
+    void store(uint8_t addr, uint8_t kb1, uint8_t kb2, uint32_t speed, uint32_t p4Time);
+private:
+    struct Entry {
+        uint8_t  addr;
+        uint8_t  kb1;
+        uint8_t  kb2;
+        uint8_t  valid;
+        uint16_t p4Time; // us
+        uint16_t rate;   // baud rate / 100
+    };
+    struct StoredCache {
+        uint16_t magic;
+        uint8_t  next;   // the entry to replace
+        uint8_t  reserved;
+        Entry    entries[MAX_ENTRIES];
+        uint16_t crc;
+    };
+    void load();
+    int  lookup(uint8_t addr, uint8_t kb1, uint8_t kb2, uint16_t rate) const;
+    bool        loaded_;
+    StoredCache cache_;
+};
+
+#endif //__P4_CACHE_H__
@@ -44,6 +44,14 @@ enum ProtocolTypes {
    PROT_ISO15765_USR_B = 0x0B
 };
 
+// Bus monitor modes, "ATMA", "ATMR hh" and "ATMT hh"
+//
+enum MonitorModes {
+   MONITOR_ALL = 0,
+   MONITOR_RECEIVER,
+   MONITOR_TRANSMITTER
+};
+
 // Adapters
 //
 enum AdapterTypes {
@@ -75,6 +83,7 @@ public:
     bool isConnected() const { return connected_; }
     virtual void monitor() {}
     virtual void monitor(const uint8_t* data, uint32_t len, uint32_t numOfResp) {}
+    virtual int busMonitor(int mode, uint8_t addr) { return REPLY_CMD_WRONG; }
     void setStatus(int sts) { sts_ = sts; }
     int getStatus() const { return sts_; }
     static void clearHistory();
@@ -268,6 +268,7 @@ int PwmAdapter::requestImpl(const uint8_t* data, uint32_t len, uint32_t numOfRes
 
     // Set the reply operation timeout
     timer_->start(p2Timeout);
+    TimeoutManager::instance()->requestSent();
     
     uint32_t num = 0;
     do {
@@ -285,8 +286,8 @@ int PwmAdapter::requestImpl(const uint8_t* data, uint32_t len, uint32_t numOfRes
             continue;
         }
         
-        // Measure the response time
-        TimeoutManager::instance()->p2Timeout(timer_->value());
+        // Measure the response time, the first message only
+        TimeoutManager::instance()->responseReceived(msg->data()[2]);
         
         num++; // number of received messages
 
@@ -0,0 +1,139 @@
+/**
+ * See the file LICENSE for redistribution information.
+ *
+ * Copyright (c) 2009-2018 ObdDiag.Net. All rights reserved.
+ *
+ */
+
+#include <crc16.h>
+#include "respondersets.h"
+
+using namespace util;
+
+const int MAX_MISSES = 3; // relearn the smaller set after that many
+
+/**
+ * Check the ID is in the list
+ * @param[in] id The CAN ID
+ * @param[in] ids The list of IDs
+ * @param[in] num The list length
+ * @return true if found
+ */
+static bool Contains(uint32_t id, const uint32_t* ids, int num)
+{
+    for (int i = 0; i < num; i++) {
+        if (ids[i] == id)
+            return true;
+    }
+    return false;
+}
+
+/**
+ * Forget all the learned sets
+ */
+void ResponderSets::clear()
+{
+    for (int i = 0; i < MAX_SETS; i++) {
+        sets_[i].num = 0;
+        sets_[i].lastUse = 0;
+    }
+    useCounter_ = 0;
+}
+
+/**
+ * The request signature, the request CAN ID and data
+ * @param[in] id The request CAN ID
+ * @param[in] data The request data bytes
+ * @param[in] len The request length
+ * @return The signature
+ */
+uint32_t ResponderSets::signature(uint32_t id, const uint8_t* data, uint32_t len)
+{
+    uint8_t idBytes[] = {
+        static_cast<uint8_t>(id),
+        static_cast<uint8_t>(id >> 8),
+        static_cast<uint8_t>(id >> 16),
+        static_cast<uint8_t>(id >> 24)
+    };
+    uint16_t crc = crc16(data, len, crc16(idBytes, sizeof(idBytes)));
+    return (len << 16) | crc;
+}
+
+/**
+ * Find the learned set
+ * @param[in] signature The request signature
+ * @return The set index, -1 if not learned yet
+ */
+int ResponderSets::find(uint32_t signature) const
+{
+    for (int i = 0; i < MAX_SETS; i++) {
+        if (sets_[i].num && sets_[i].signature == signature)
+            return i;
+    }
+    return -1;
+}
+
+/**
+ * All the learned responders have answered
+ * @param[in] index The set index
+ * @param[in] ids The responders answered so far
+ * @param[in] num The number of responders answered
+ * @return true if nothing else is expected
+ */
+bool ResponderSets::isComplete(int index, const uint32_t* ids, int num) const
+{
+    const ResponderSet& set = sets_[index];
+    for (int i = 0; i < set.num; i++) {
+        if (!Contains(set.ids[i], ids, num))
+            return false;
+    }
+    return true;
+}
+
+/**
+ * Learn from the completed request. The set grows with any new responder,
+ * a responder is dropped only after a few timed out runs without it
+ * @param[in] signature The request signature
+ * @param[in] ids The responders answered
+ * @param[in] num The number of responders answered
+ * @param[in] timedOut The request waited for the full timeout
+ */
+void ResponderSets::update(uint32_t signature, const uint32_t* ids, int num, bool timedOut)
+{
+    int index = find(signature);
+    if (index < 0) {
+        if (num == 0)
+            return;
+        index = 0; // the least recently used one
+        for (int i = 1; i < MAX_SETS; i++) {
+            if (sets_[i].lastUse < sets_[index].lastUse) {
+                index = i;
+            }
+        }
+        sets_[index].signature = signature;
+        sets_[index].num = 0;
+        sets_[index].misses = 0;
+    }
+    
+    ResponderSet& set = sets_[index];
+    set.lastUse = ++useCounter_;
+    if (!timedOut)
+        return; // the early completion, nothing new
+    
+    bool missing = !isComplete(index, ids, num);
+    for (int i = 0; i < num && set.num < MAX_RESPONDERS; i++) {
+        if (!Contains(ids[i], set.ids, set.num)) {
+            set.ids[set.num++] = ids[i];
+        }
+    }
+    if (!missing) {
+        set.misses = 0;
+    }
+    else if (++set.misses >= MAX_MISSES) {
+        set.num = 0; // relearn from this run
+        for (int i = 0; i < num && i < MAX_RESPONDERS; i++) {
+            set.ids[set.num++] = ids[i];
+        }
+        set.misses = 0;
+    }
+}
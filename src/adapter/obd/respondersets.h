@@ -0,0 +1,41 @@
+/**
+ * See the file LICENSE for redistribution information.
+ *
+ * Copyright (c) 2009-2018 ObdDiag.Net. All rights reserved.
+ *
+ */
+
+#ifndef __RESPONDER_SETS_H__
+#define __RESPONDER_SETS_H__
+
+#include <cstdint>
+
+using namespace std;
+
+// The learned responder CAN IDs per request signature, lets the
+// request complete as soon as all the known responders have answered
+//
+class ResponderSets {
+public:
+    const static int MAX_SETS       = 16;
+    const static int MAX_RESPONDERS = 8;
+    
+    ResponderSets() { clear(); }
+    void clear();
+    int find(uint32_t signature) const;
+    bool isComplete(int index, const uint32_t* ids, int num) const;
+    void update(uint32_t signature, const uint32_t* ids, int num, bool timedOut);
+    static uint32_t signature(uint32_t id, const uint8_t* data, uint32_t len);
+private:
+    struct ResponderSet {
+        uint32_t signature;
+        uint32_t ids[MAX_RESPONDERS];
+        uint32_t lastUse;
+        uint8_t  num;
+        uint8_t  misses; // timed out runs with a learned responder missing
+    };
+    ResponderSet sets_[MAX_SETS];
+    uint32_t useCounter_;
+};
+
+#endif //__RESPONDER_SETS_H__
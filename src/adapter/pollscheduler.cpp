@@ -0,0 +1,158 @@
+/**
+ * See the file LICENSE for redistribution information.
+ *
+ * Copyright (c) 2009-2018 ObdDiag.Net. All rights reserved.
+ *
+ */
+
+#include <cstdio>
+#include <cstring>
+#include <CmdUart.h>
+#include <Timer.h>
+#include "datacollector.h"
+#include "binarylink.h"
+#include "obd/obdprofile.h"
+#include "pollscheduler.h"
+
+using namespace util;
+
+const uint32_t UsecInMsec = 1000;
+
+/**
+ * PollScheduler singleton
+ * @return The PollScheduler instance
+ */
+PollScheduler* PollScheduler::instance()
+{
+    static PollScheduler instance;
+    return &instance;
+}
+
+/**
+ * Construct PollScheduler object
+ */
+PollScheduler::PollScheduler()
+  : numOfEntries_(0),
+    collector_(new DataCollector(OBD_IN_MSG_DLEN)),
+    clock_(MicroTimer::instance())
+{
+}
+
+/**
+ * Add the request to the poll list, "ATPLA pppp data"
+ * @param[in] period The poll period in milliseconds
+ * @param[in] request The request hex digits with optional number of responses
+ * @return true if added, false if the list is full or the request is wrong
+ */
+bool PollScheduler::add(uint32_t period, const string& request)
+{
+    uint32_t len = request.length();
+    if (numOfEntries_ >= MAX_ENTRIES || period == 0 || len < 2 || len > REQUEST_LEN)
+        return false;
+    
+    // The hex pairs with the optional number of responses digit, as typed in
+    collector_->reset();
+    for (const char* p = request.c_str(); *p; p++) {
+        collector_->putChar(*p);
+    }
+    collector_->complete();
+    if (!collector_->isData() || collector_->getLength() == 0)
+        return false;
+    
+    PollEntry& entry = entries_[numOfEntries_++];
+    memcpy(entry.request, request.c_str(), len + 1);
+    entry.period = period * UsecInMsec;
+    entry.due = 0;
+    entry.count = entry.missed = entry.maxLate = 0;
+    entry.sumLate = 0;
+    return true;
+}
+
+/**
+ * The entry with the earliest deadline
+ * @return The entry pointer
+ */
+PollScheduler::PollEntry* PollScheduler::nextDue()
+{
+    PollEntry* next = &entries_[0];
+    for (int i = 1; i < numOfEntries_; i++) {
+        if (static_cast<int32_t>(entries_[i].due - next->due) < 0) {
+            next = &entries_[i];
+        }
+    }
+    return next;
+}
+
+/**
+ * Send the request and stream the reply, update the entry statistics
+ * @param[in] entry The poll entry
+ */
+void PollScheduler::execute(PollEntry& entry)
+{
+    uint32_t late = clock_->value() - entry.due;
+    entry.maxLate = (late > entry.maxLate) ? late : entry.maxLate;
+    entry.sumLate += late;
+    entry.count++;
+    
+    collector_->reset();
+    for (const char* p = entry.request; *p; p++) {
+        collector_->putChar(*p);
+    }
+    collector_->complete();
+    int status = OBDProfile::instance()->onRequest(collector_);
+    if (BinaryLink::isActive()) {
+        BinaryLink::instance()->sendStatus(status);
+    }
+    
+    // Schedule the next one, the deadlines already passed are missed
+    entry.due += entry.period;
+    uint32_t now = clock_->value();
+    while (static_cast<int32_t>(now - entry.due) > 0) {
+        entry.due += entry.period;
+        entry.missed++;
+    }
+}
+
+/**
+ * Run the poll list until any key pressed, "ATPLS"
+ */
+void PollScheduler::run()
+{
+    CmdUart* uart = CmdUart::instance();
+    uint32_t now = clock_->value();
+    
+    for (int i = 0; i < numOfEntries_; i++) {
+        PollEntry& entry = entries_[i];
+        entry.due = now;
+        entry.count = entry.missed = entry.maxLate = 0;
+        entry.sumLate = 0;
+    }
+    
+    uart->monitor(true);
+    while (!uart->isMonitorExit()) {
+        PollEntry* entry = nextDue();
+        if (static_cast<int32_t>(clock_->value() - entry->due) >= 0) {
+            execute(*entry);
+        }
+    }
+    AdptSendReply("STOPPED");
+    uart->monitor(false);
+}
+
+/**
+ * Print the statistics of the last run, "ATPLR", the jitter is in 0.1ms
+ */
+void PollScheduler::report() const
+{
+    const uint32_t tenthMsec = UsecInMsec / 10;
+    char out[64];
+    
+    for (int i = 0; i < numOfEntries_; i++) {
+        const PollEntry& entry = entries_[i];
+        uint32_t avgLate = entry.count ? static_cast<uint32_t>(entry.sumLate / entry.count) : 0;
+        sprintf(out, "%s P:%lu N:%lu MISS:%lu JMAX:%lu JAVG:%lu", entry.request,
+                entry.period / UsecInMsec, entry.count, entry.missed,
+                entry.maxLate / tenthMsec, avgLate / tenthMsec);
+        AdptSendReply(out);
+    }
+}
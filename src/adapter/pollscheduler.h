@@ -0,0 +1,54 @@
+/**
+ * See the file LICENSE for redistribution information.
+ *
+ * Copyright (c) 2009-2018 ObdDiag.Net. All rights reserved.
+ *
+ */
+
+#ifndef __POLL_SCHEDULER_H__
+#define __POLL_SCHEDULER_H__
+
+#include <cstdint>
+#include <lstring.h>
+#include "adaptertypes.h"
+
+using namespace std;
+
+class DataCollector;
+class MicroTimer;
+
+// On-adapter periodic request polling, the requests are sent by the adapter
+// on their own schedule and the replies streamed until any key pressed
+//
+class PollScheduler {
+public:
+    const static int MAX_ENTRIES = 8;
+    const static int REQUEST_LEN = OBD_IN_MSG_DLEN * 2 + 1; // with num of responses
+    
+    static PollScheduler* instance();
+    bool add(uint32_t period, const util::string& request);
+    void clear() { numOfEntries_ = 0; }
+    bool isEmpty() const { return numOfEntries_ == 0; }
+    void run();
+    void report() const;
+private:
+    struct PollEntry {
+        char     request[REQUEST_LEN + 1];
+        uint32_t period;    // usec
+        uint32_t due;       // usec, the next deadline
+        uint32_t count;     // requests sent
+        uint32_t missed;    // deadlines skipped
+        uint32_t maxLate;   // usec, the worst start jitter
+        uint64_t sumLate;   // usec, for the average
+    };
+    PollScheduler();
+    PollEntry* nextDue();
+    void execute(PollEntry& entry);
+    
+    PollEntry entries_[MAX_ENTRIES];
+    int numOfEntries_;
+    DataCollector* collector_;
+    MicroTimer* clock_;
+};
+
+#endif //__POLL_SCHEDULER_H__
@@ -0,0 +1,119 @@
+/**
+ * See the file LICENSE for redistribution information.
+ *
+ * Copyright (c) 2009-2018 ObdDiag.Net. All rights reserved.
+ *
+ */
+
+#include <algorithms.h>
+#include <hexcodec.h>
+#include "adaptertypes.h"
+#include "replywriter.h"
+
+using namespace std;
+using namespace util;
+
+/**
+ * Constructor, fetch the spaces setting once per line
+ */
+ReplyWriter::ReplyWriter()
+  : uart_(CmdUart::instance())
+{
+    spaces_ = AdapterConfig::instance()->getBoolProperty(PAR_SPACES);
+}
+
+/**
+ * Write null terminated string
+ * @param[in] str The string
+ */
+void ReplyWriter::put(const char* str)
+{
+    while (*str) {
+        uart_->put(*str++);
+    }
+}
+
+/**
+ * Write string
+ * @param[in] str The string
+ */
+void ReplyWriter::put(const util::string& str)
+{
+    put(str.c_str());
+}
+
+/**
+ * Write one hex digit
+ * @param[in] val The value 0..15
+ */
+void ReplyWriter::nibble(uint8_t val)
+{
+    uart_->put(to_ascii(val & 0x0F));
+}
+
+/**
+ * Write one byte as two hex digits
+ * @param[in] byte The byte
+ */
+void ReplyWriter::hex(uint8_t byte)
+{
+    uint16_t pair = HexEncodeTable[byte];
+    uart_->put(pair & 0xFF);
+    uart_->put(pair >> 8);
+}
+
+/**
+ * Write the byte sequence as hex, separated by spaces if enabled
+ * @param[in] bytes The bytes
+ * @param[in] length The number of bytes
+ */
+void ReplyWriter::hex(const uint8_t* bytes, uint32_t length)
+{
+    const uint32_t ChunkLen = 16;
+    char buff[ChunkLen * 3];
+
+    for (uint32_t i = 0; i < length; i += ChunkLen) {
+        uint32_t n = min(length - i, ChunkLen);
+        if (i > 0) {
+            space();
+        }
+        uint32_t len = spaces_ ? hex_encode_spaced(bytes + i, n, buff) : hex_encode(bytes + i, n, buff);
+        uart_->put(buff, len);
+    }
+}
+
+/**
+ * Write CAN identifier, 3 digits for 11 bit, 4 bytes for 29 bit
+ * @param[in] id The identifier
+ * @param[in] extended 29 bit identifier flag
+ */
+void ReplyWriter::canId(uint32_t id, bool extended)
+{
+    IntAggregate value(id);
+
+    if (!extended) { // 11 bit standard CAN identifier
+        nibble(value.bvalue[1]);
+        hex(value.bvalue[0]);
+    }
+    else { // 29 bit extended CAN identifier
+        hex(value.bvalue[3]);
+        space();
+        hex(value.bvalue[2]);
+        space();
+        hex(value.bvalue[1]);
+        space();
+        hex(value.bvalue[0]);
+    }
+}
+
+/**
+ * Terminate the line with <CR> or <CR><LF> and send it out
+ */
+void ReplyWriter::endl()
+{
+    uart_->put('\r');
+    if (AdapterConfig::instance()->getBoolProperty(PAR_LINEFEED)) {
+        uart_->put('\n');
+    }
+    uart_->commit();
+}
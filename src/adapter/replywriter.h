@@ -0,0 +1,38 @@
+/**
+ * See the file LICENSE for redistribution information.
+ *
+ * Copyright (c) 2009-2018 ObdDiag.Net. All rights reserved.
+ *
+ */
+
+#ifndef __REPLY_WRITER_H__
+#define __REPLY_WRITER_H__
+
+#include <cstdint>
+#include <lstring.h>
+#include <CmdUart.h>
+
+using namespace std;
+
+// Formats the reply line straight into the UART TX ring,
+// the line is published on endl()
+//
+class ReplyWriter {
+public:
+    ReplyWriter();
+    void put(char ch) { uart_->put(ch); }
+    void put(const char* str);
+    void put(const util::string& str);
+    void nibble(uint8_t val);
+    void hex(uint8_t byte);
+    void hex(const uint8_t* bytes, uint32_t length);
+    void space() { if (spaces_) uart_->put(' '); }
+    void canId(uint32_t id, bool extended);
+    void endl();
+    bool isSpaces() const { return spaces_; }
+private:
+    CmdUart* uart_;
+    bool spaces_;
+};
+
+#endif //__REPLY_WRITER_H__
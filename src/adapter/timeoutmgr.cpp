@@ -5,14 +5,20 @@
  *
  */
 
+#include <cstring>
 #include <algorithms.h>
+#include <Timer.h>
 #include "adaptertypes.h"
 #include "timeoutmgr.h"
 #include "obd/obdprofile.h"
 
 const uint32_t AT1_VALUE  = 30;
 const uint32_t AT2_VALUE  = 10;
+const uint32_t AT1_PERCENTILE = 99;
+const uint32_t AT2_PERCENTILE = 95;
 const uint32_t THRESHOLD  =  2;
+const uint32_t DECAY_LIMIT = 64;   // Halve the histogram when the sample count gets here
+const uint32_t STALE_LIMIT = 256;  // Ignore the responders silent for that many samples
 const uint32_t DEFAULT_TIMEOUT = 200; // Default setting for ELM327
 
 using namespace util;
@@ -20,8 +26,9 @@ using namespace util;
 /**
  * Construct the TimeoutManager object
  */
-TimeoutManager::TimeoutManager() : mode_(AT1), timeout_(0), threshold_(0)
+TimeoutManager::TimeoutManager() : mode_(AT1), requestTime_(0), seenNum_(0)
 {
+    reset();
 }
 
 /**
@@ -35,47 +42,178 @@ TimeoutManager* TimeoutManager::instance()
 }
 
 /**
- *  Set P2 timeout
+ *  Forget all the responder latencies
+ */
+void TimeoutManager::reset()
+{
+    threshold_ = 0;
+    useCounter_ = 0;
+    for (int i = 0; i < MAX_RESPONDERS; i++) {
+        hist_[i].active = false;
+    }
+}
+
+/**
+ *  The request is sent, the response times are measured from now on
+ */
+void TimeoutManager::requestSent()
+{
+    requestTime_ = MicroTimer::instance()->value();
+    seenNum_ = 0;
+}
+
+/**
+ *  The response received, only the first response of every responder is
+ *  the P2 sample, the others are the consecutive frames or messages gaps
+ *  @param[in] responder The responder ECU address or CAN ID
+ */
+void TimeoutManager::responseReceived(uint32_t responder)
+{
+    for (int i = 0; i < seenNum_; i++) {
+        if (seen_[i] == responder)
+            return;
+    }
+    if (seenNum_ == MAX_RESPONDERS)
+        return;
+    seen_[seenNum_++] = responder;
+    
+    uint32_t elapsed = MicroTimer::instance()->value() - requestTime_;
+    p2Timeout(elapsed / 1000, responder);
+}
+
+/**
+ *  Set P2 timeout, the responder is not known
+ *  @param[in] val The measured response time
  */
 void TimeoutManager::p2Timeout(uint32_t val)
+{
+    p2Timeout(val, 0);
+}
+
+/**
+ *  Set P2 timeout for the responder
+ *  @param[in] val The measured response time
+ *  @param[in] responder The responder ECU address or CAN ID
+ */
+void TimeoutManager::p2Timeout(uint32_t val, uint32_t responder)
 {
     // Skip the first few timeouts, like ISO9141 slow init responses
     if (threshold_ < THRESHOLD) {
         threshold_++;
+        return;
+    }
+    
+    LatencyHistogram* hist = getHistogram(responder);
+    val = min(val, at0Timeout());
+    uint32_t bin = min(val / LatencyHistogram::BIN_WIDTH, uint32_t(LatencyHistogram::BINS - 1));
+    if (bin == LatencyHistogram::BINS - 1) {
+        hist->overflowMax = max(hist->overflowMax, val);
     }
-    else {
-        timeout_ = min(max(timeout_, val), at0Timeout());
+    hist->bins[bin]++;
+    hist->total++;
+    hist->lastUse = ++useCounter_;
+    
+    // Decay, the older samples weigh less
+    if (hist->total >= DECAY_LIMIT) {
+        hist->total = 0;
+        for (int i = 0; i < LatencyHistogram::BINS; i++) {
+            hist->bins[i] /= 2;
+            hist->total += hist->bins[i];
+        }
+        if (hist->bins[LatencyHistogram::BINS - 1] == 0) {
+            hist->overflowMax = 0;
+        }
     }
     
 #ifdef DEBUG_TM_VAL
     uint8_t data[2];
     util::string str;
     data[0] = val & 0xFF;
-    data[1] = timeout_ & 0xFF;
+    data[1] = percentile(*hist, AT1_PERCENTILE) & 0xFF;
     to_ascii(data, 2, str);
     AdptSendReply2(str);
 #endif
 }
+
+/**
+ *  Find the responder histogram, replace the least recently used one if not found
+ *  @param[in] responder The responder ECU address or CAN ID
+ *  @return The histogram pointer
+ */
+LatencyHistogram* TimeoutManager::getHistogram(uint32_t responder)
+{
+    LatencyHistogram* hist = &hist_[0];
+    for (int i = 0; i < MAX_RESPONDERS; i++) {
+        if (hist_[i].active && hist_[i].responder == responder)
+            return &hist_[i];
+        if (!hist_[i].active) {
+            if (hist->active)
+                hist = &hist_[i];
+        }
+        else if (hist->active && hist_[i].lastUse < hist->lastUse) {
+            hist = &hist_[i];
+        }
+    }
+    memset(hist, 0, sizeof(LatencyHistogram));
+    hist->responder = responder;
+    hist->active = true;
+    return hist;
+}
+
+/**
+ *  Get the latency percentile for the responder
+ *  @param[in] hist The responder histogram
+ *  @param[in] pct The percentile value
+ *  @return The latency in ms
+ */
+uint32_t TimeoutManager::percentile(const LatencyHistogram& hist, uint32_t pct) const
+{
+    uint32_t count = (hist.total * pct + 99) / 100;
+    uint32_t sum = 0;
+    for (int i = 0; i < LatencyHistogram::BINS - 1; i++) {
+        sum += hist.bins[i];
+        if (sum >= count)
+            return (i + 1) * LatencyHistogram::BIN_WIDTH;
+    }
+    return hist.overflowMax;
+}
+
+/**
+ *  Get the adaptive timeout, the slowest of the recently heard responders
+ *  @param[in] pct The percentile value
+ *  @param[in] margin The margin added, ms
+ *  @return The timeout value, 0 if no responder is known yet
+ */
+uint32_t TimeoutManager::adaptiveTimeout(uint32_t pct, uint32_t margin) const
+{
+    uint32_t timeout = 0;
+    bool found = false;
+    for (int i = 0; i < MAX_RESPONDERS; i++) {
+        const LatencyHistogram& hist = hist_[i];
+        if (!hist.active || hist.total == 0 || (useCounter_ - hist.lastUse) > STALE_LIMIT)
+            continue;
+        timeout = max(timeout, percentile(hist, pct));
+        found = true;
+    }
+    return found ? (min(timeout, at0Timeout()) + margin) : 0;
+}
     
 /**
  *  Get P2 timeout
  */
 uint32_t TimeoutManager::p2Timeout() const
 {
-    if (timeout_ == 0) {
-        return at0Timeout(); // The very first time
-    }
     uint32_t timeout = 0;    
     switch (mode_) {
         case AT1:
-            timeout = at1Timeout();
+            timeout = adaptiveTimeout(AT1_PERCENTILE, AT1_VALUE);
             break;
         case AT2:
-            timeout = at2Timeout();
+            timeout = adaptiveTimeout(AT2_PERCENTILE, AT2_VALUE);
             break;
-        case AT0:
-        default:
-            timeout = at0Timeout();
+    }
+    if (timeout == 0) {
+        timeout = at0Timeout(); // AT0 or the very first time
     }
 #ifdef DEBUG_TM_VAL2
     uint8_t data[2];
@@ -98,22 +236,6 @@ uint32_t TimeoutManager::at0Timeout() const
     return p2Timeout ? (p2Timeout * 4 * timeoutMultVal) : DEFAULT_TIMEOUT; 
 }
 
-/**
- *  Get the timeout for AT1 mode
- */
-uint32_t TimeoutManager::at1Timeout() const
-{
-    return timeout_ + AT1_VALUE;
-}
-
-/**
- *  Get the timeout for AT0 mode
- */
-uint32_t TimeoutManager::at2Timeout() const
-{
-    return timeout_ + AT2_VALUE;
-}
-
 /**
  *  Get the timeout multiplier for CAN/J1939
  */
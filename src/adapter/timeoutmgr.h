@@ -1,7 +1,7 @@
 /**
  * See the file LICENSE for redistribution information.
  *
- * Copyright (c) 2009-2017 ObdDiag.Net. All rights reserved.
+ * Copyright (c) 2009-2018 ObdDiag.Net. All rights reserved.
  *
  */
 
@@ -12,6 +12,20 @@
 
 using namespace std;
 
+// Response latency histogram of a single responder, ECU address or CAN ID
+//
+struct LatencyHistogram {
+    const static int BINS      = 32; // 4ms each, the last one is open-ended
+    const static int BIN_WIDTH = 4;
+    
+    uint32_t responder;
+    uint32_t lastUse;
+    uint32_t overflowMax; // the longest latency in the last bin
+    uint16_t bins[BINS];
+    uint16_t total;
+    bool     active;
+};
+
 // Adaptive Timing control
 //
 class TimeoutManager {
@@ -19,21 +33,31 @@ public:
     const static int AT0 = 0;
     const static int AT1 = 1;
     const static int AT2 = 2;
+    const static int MAX_RESPONDERS = 8;
 
     static TimeoutManager* instance();
     void mode(int val) { mode_ = val; }
+    int mode() const { return mode_; }
     void p2Timeout(uint32_t timeout);
-    void reset() { timeout_ = 0, threshold_ = 0; }
+    void p2Timeout(uint32_t timeout, uint32_t responder);
+    void requestSent();
+    void responseReceived(uint32_t responder);
+    void reset();
     uint32_t p2Timeout() const;
     uint32_t at0Timeout() const;
 private:
     TimeoutManager();
-    uint32_t at1Timeout() const;
-    uint32_t at2Timeout() const;
+    LatencyHistogram* getHistogram(uint32_t responder);
+    uint32_t percentile(const LatencyHistogram& hist, uint32_t pct) const;
+    uint32_t adaptiveTimeout(uint32_t pct, uint32_t margin) const;
     bool multiplier() const;
     int mode_;
-    uint32_t timeout_;
     uint32_t threshold_;
+    uint32_t useCounter_;
+    LatencyHistogram hist_[MAX_RESPONDERS];
+    uint32_t requestTime_;           // us
+    uint32_t seen_[MAX_RESPONDERS];  // the responders answered the request
+    int      seenNum_;
 };
 
 #endif
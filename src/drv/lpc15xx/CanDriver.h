@@ -15,6 +15,9 @@ using namespace std;
 typedef void *CAN_HANDLE_T;
 struct CanMsgBuffer;
 
+// Called from CAN ISR when the queued frame is sent
+typedef void (*CanTxCallbackT)(const CanMsgBuffer* msg);
+
 class CanDriver {
 public:
     const static int J1939_CAN_250K    = 0;
@@ -24,6 +27,9 @@ public:
     static void configure();
     void setSpeed(int speed);
     bool send(const CanMsgBuffer* buff);
+    bool queue(const CanMsgBuffer* buff, bool urgent = false, CanTxCallbackT callback = nullptr);
+    bool isTxIdle() const;
+    void clearTx();
     bool setFilterAndMask(uint32_t filter, uint32_t mask, bool extended);
     bool setFilterAndMask(uint32_t filter, uint32_t mask, bool extended, int num);
     bool isReady() const;
@@ -35,6 +41,8 @@ public:
     void clearFilters();
     void clearData();
     void setSilent(bool val);
+    uint32_t getOverflows() const;
+    uint32_t getErrorCounters() const;
     uint32_t getBit();
     static CAN_HANDLE_T handle_;
 private:
@@ -26,13 +26,42 @@ const uint32_t PinAssign = ((RxPin << 16) + (RxPort * 32)) | ((TxPin << 8)  + (T
 const uint32_t CAN_MSGOBJ_STD = 0x00000000;
 const uint32_t CAN_MSGOBJ_EXT = 0x20000000;
 const int FIFO_NUM = 10;
+const uint32_t RX_QUEUE_LEN = 64; // power of 2
+const uint32_t TX_QUEUE_LEN = 16; // power of 2
+const uint8_t  TX_URGENT_OBJ = 27; // lower number wins inside the controller
+const uint8_t  TX_FIRST_OBJ  = 28;
+const uint8_t  TX_LAST_OBJ   = 31;
+const uint32_t TX_BATCH_MASK = 0xF0000000; // objects 28..31
+
+static void CanNative2Msg(const CAN_MSG_OBJ* msg1, CanMsgBuffer* msg2);
+static void CanMsg2Native(const CanMsgBuffer* msg1, CAN_MSG_OBJ* msg2, uint8_t msgobj);
+static void LoadTxMailboxes();
 
 // Driver static variables
 CAN_HANDLE_T CanDriver::handle_;
-static volatile uint32_t msgBitMask;
 static volatile bool txInProgress;
 static volatile bool txError;
 
+// Single producer (ISR), single consumer (read) frame queue in arrival order,
+// the head is the running sequence number
+static CanMsgBuffer rxQueue[RX_QUEUE_LEN];
+static volatile uint32_t rxHead;
+static volatile uint32_t rxTail;
+static volatile uint32_t rxOverflows;
+
+// TX queues, accessed with CAN interrupt disabled or from CAN ISR
+struct CanTxQueue {
+    CanMsgBuffer   msg[TX_QUEUE_LEN];
+    CanTxCallbackT callback[TX_QUEUE_LEN];
+    uint32_t       head;
+    uint32_t       tail;
+};
+static CanTxQueue txUrgent;
+static CanTxQueue txBatch;
+static CanMsgBuffer txMailbox[TX_LAST_OBJ - TX_URGENT_OBJ + 1];
+static CanTxCallbackT txMailboxCallback[TX_LAST_OBJ - TX_URGENT_OBJ + 1];
+static volatile uint32_t txBusyMask;
+
 // C-CAN callbacks
 extern "C" {
     void C_CAN0_IRQHandler(void)
@@ -44,17 +73,40 @@ extern "C" {
         // Blink LED from here, when RX operation is completed
         AdptLED::instance()->blinkRx();
         
-        // Just set bitmask
-        msgBitMask |= (1 << objNum);
+        // Drain the message object right away, the oldest frames are kept
+        CAN_MSG_OBJ msg;
+        msg.msgobj = objNum;
+        LPC_CAND_API->hwCAN_MsgReceive(CanDriver::handle_, &msg);
+        uint32_t head = rxHead;
+        if (head - rxTail >= RX_QUEUE_LEN) {
+            rxOverflows++;
+            return;
+        }
+        CanMsgBuffer* buff = &rxQueue[head & (RX_QUEUE_LEN - 1)];
+        CanNative2Msg(&msg, buff);
+        buff->seq = head;
+        __DMB(); // the record is complete before published
+        rxHead = head + 1;
     }
 
     void CAN_tx(uint8_t msgObjNum)
     {
-        // Clear transmission in progress flag
-        txInProgress = false;
-        
         // Blink LED from here, when TX operation is completed
         AdptLED::instance()->blinkTx();
+
+        if (msgObjNum < TX_URGENT_OBJ) {
+            // Clear transmission in progress flag
+            txInProgress = false;
+            return;
+        }
+
+        // Queued frame is out, notify and reload the mailboxes
+        int idx = msgObjNum - TX_URGENT_OBJ;
+        txBusyMask &= ~(1 << msgObjNum);
+        if (txMailboxCallback[idx]) {
+            (*txMailboxCallback[idx])(&txMailbox[idx]);
+        }
+        LoadTxMailboxes();
     }
 
     void CAN_error(uint32_t errorInfo)
@@ -85,6 +137,44 @@ static void SetFIFOItem(uint32_t msgobj)
     while(LPC_C_CAN0->CANIF1_CMDREQ & IFCREQ_BUSY);
 }
 
+/**
+ * Put the queued frame to the message object
+ * @parameter queue The TX queue
+ * @parameter msgobj C-CAN message object number
+ */
+static void TransmitQueued(CanTxQueue& queue, uint8_t msgobj)
+{
+    CAN_MSG_OBJ msg;
+    uint32_t pos = queue.tail++ & (TX_QUEUE_LEN - 1);
+    int idx = msgobj - TX_URGENT_OBJ;
+
+    txMailbox[idx] = queue.msg[pos];
+    txMailboxCallback[idx] = queue.callback[pos];
+    txBusyMask |= (1 << msgobj);
+    CanMsg2Native(&txMailbox[idx], &msg, msgobj);
+    LPC_CAND_API->hwCAN_MsgTransmit(CanDriver::handle_, &msg);
+}
+
+/**
+ * Move the queued frames to the free message objects. The urgent frames
+ * use one object below the batch ones, so the controller sends them first.
+ * The batch objects are loaded only all together to keep the frame order,
+ * called with CAN interrupt disabled or from CAN ISR
+ */
+static void LoadTxMailboxes()
+{
+    if (!(txBusyMask & (1 << TX_URGENT_OBJ)) && txUrgent.head != txUrgent.tail) {
+        TransmitQueued(txUrgent, TX_URGENT_OBJ);
+    }
+    if (txBusyMask & TX_BATCH_MASK)
+        return;
+    for (uint8_t msgobj = TX_FIRST_OBJ; msgobj <= TX_LAST_OBJ; msgobj++) {
+        if (txBatch.head == txBatch.tail)
+            break;
+        TransmitQueued(txBatch, msgobj);
+    }
+}
+
 /**
  * Convert CAN_MSG_OBJ to CanMsgBuffer
  * @parameter   msg1   CAN_MSG_OBJ instance
@@ -150,7 +240,6 @@ CanDriver::CanDriver() : speed_(-1)
 {
     // Enable the CAN Interrupt
     NVIC_EnableIRQ(C_CAN0_IRQn);
-    msgBitMask = 0;
 }
 
 void CanDriver::setSpeed(int speed)
@@ -160,6 +249,7 @@ void CanDriver::setSpeed(int speed)
     
     if(speed_ == speed) // Nothing to update
         return;
+    clearTx(); // the controller reset drops the pending mailboxes
 
     // Initialize the CAN controller for ISO15765_CAN_500K/J1939_CAN_250K
     //
@@ -208,7 +298,9 @@ bool CanDriver::send(const CanMsgBuffer* buff)
 
     txInProgress = true;
     txError = false;
+    NVIC_DisableIRQ(C_CAN0_IRQn); // ISR reloads the TX mailboxes
     LPC_CAND_API->hwCAN_MsgTransmit(handle_, &msg);
+    NVIC_EnableIRQ(C_CAN0_IRQn);
     while (txInProgress) {
         if (timer->isExpired())
             return false;
@@ -216,6 +308,64 @@ bool CanDriver::send(const CanMsgBuffer* buff)
     return !txError;
 }
 
+/**
+ * Queue the frame for transmit, not waiting for completion
+ * @parameter buff CanMsgBuffer instance
+ * @parameter urgent Send ahead of the regular queued frames
+ * @parameter callback Called from CAN ISR once the frame is sent, optional
+ * @return false if the queue is full
+ */
+bool CanDriver::queue(const CanMsgBuffer* buff, bool urgent, CanTxCallbackT callback)
+{
+    CanTxQueue& queue = urgent ? txUrgent : txBatch;
+    bool sts = false;
+
+    NVIC_DisableIRQ(C_CAN0_IRQn);
+    if (queue.head - queue.tail < TX_QUEUE_LEN) {
+        uint32_t pos = queue.head++ & (TX_QUEUE_LEN - 1);
+        queue.msg[pos] = *buff;
+        queue.callback[pos] = callback;
+        LoadTxMailboxes();
+        sts = true;
+    }
+    NVIC_EnableIRQ(C_CAN0_IRQn);
+    return sts;
+}
+
+/**
+ * All the queued frames are sent
+ * @return  true/false
+ */
+bool CanDriver::isTxIdle() const
+{
+    return txBusyMask == 0 && txUrgent.head == txUrgent.tail && txBatch.head == txBatch.tail;
+}
+
+/**
+ * Drop the queued frames and cancel the pending mailboxes
+ */
+void CanDriver::clearTx()
+{
+    const uint32_t IFCREQ_BUSY = 0x8000;
+    const uint32_t CMD_CTRL    = (1 << 4);
+    const uint32_t CMD_WR      = (1 << 7);
+
+    NVIC_DisableIRQ(C_CAN0_IRQn);
+    txUrgent.head = txUrgent.tail = 0;
+    txBatch.head = txBatch.tail = 0;
+    for (uint8_t msgobj = TX_URGENT_OBJ; msgobj <= TX_LAST_OBJ; msgobj++) {
+        if (!(txBusyMask & (1 << msgobj)))
+            continue;
+        // Clear TXRQST, write only control bits
+        LPC_C_CAN0->CANIF1_CMDMSK_W = CMD_WR | CMD_CTRL;
+        LPC_C_CAN0->CANIF1_MCTRL = 0;
+        LPC_C_CAN0->CANIF1_CMDREQ = msgobj + 1;
+        while(LPC_C_CAN0->CANIF1_CMDREQ & IFCREQ_BUSY);
+    }
+    txBusyMask = 0;
+    NVIC_EnableIRQ(C_CAN0_IRQn);
+}
+
 /**
  * Set the configuration for receiving messages
  *
@@ -232,10 +382,12 @@ void CanDriver::configRxMsgobj(uint32_t filter, uint32_t mask, uint8_t msgobj, b
     msg.msgobj = msgobj;
     msg.mode_id = filter | (extended ? CAN_MSGOBJ_EXT : CAN_MSGOBJ_STD);
     msg.mask = mask;
+    NVIC_DisableIRQ(C_CAN0_IRQn); // ISR uses the interface registers
     LPC_CAND_API->hwCAN_ConfigRxmsgobj(handle_, &msg);
     if (!fifoLast) {
         SetFIFOItem(msgobj);
     }
+    NVIC_EnableIRQ(C_CAN0_IRQn);
 }
 
 /**
@@ -267,17 +419,19 @@ void CanDriver::clearFilters()
 }
 
 /**
- * Clear all the message buffers except 0, used for transmit
+ * Clear all the receive message buffers, 0 and 27..31 are used for transmit
  */
 void CanDriver::clearData()
 {
     CAN_MSG_OBJ msg;
-    for (int i = 1; i < 32; i++) {
+    NVIC_DisableIRQ(C_CAN0_IRQn);
+    for (int i = 1; i < TX_URGENT_OBJ; i++) {
         msg.dlc = msg.mode_id = 0;
         msg.msgobj = i;
         LPC_CAND_API->hwCAN_MsgReceive(CanDriver::handle_, &msg);
     }
-    msgBitMask = 0;
+    rxTail = rxHead;
+    NVIC_EnableIRQ(C_CAN0_IRQn);
 }
 
 /**
@@ -303,21 +457,13 @@ bool CanDriver::setFilterAndMask(uint32_t filter, uint32_t mask, bool extended,
  */
 bool CanDriver::read(CanMsgBuffer* buff)
 {
-    CAN_MSG_OBJ msg;
-    msg.mode_id = 0xFFFFFFFF;
-    msg.dlc = 0;
-    uint32_t mask = msgBitMask;
-    for (int i = 1; i < 32; i++) {
-        uint32_t val = 1 << i;
-        if (val & mask) {
-            msgBitMask &= ~val;
-            msg.msgobj = i;
-            LPC_CAND_API->hwCAN_MsgReceive(CanDriver::handle_, &msg);
-            CanNative2Msg(&msg, buff);
-            return (msg.mode_id != 0xFFFFFFFF);
-        }
-    }
-    return false;
+    uint32_t tail = rxTail;
+    if (tail == rxHead)
+        return false;
+    __DMB(); // read the record after the index
+    *buff = rxQueue[tail & (RX_QUEUE_LEN - 1)];
+    rxTail = tail + 1;
+    return true;
 }
 
 /**
@@ -326,7 +472,25 @@ bool CanDriver::read(CanMsgBuffer* buff)
  */
 bool CanDriver::isReady() const
 {
-    return (msgBitMask != 0L);
+    return (rxHead != rxTail);
+}
+
+/**
+ * The number of frames dropped because the queue was full
+ * @return  The dropped frames count since power on
+ */
+uint32_t CanDriver::getOverflows() const
+{
+    return rxOverflows;
+}
+
+/**
+ * Read the CAN error counters
+ * @return  TX error counter in bits 7..0, RX error counter in bits 14..8
+ */
+uint32_t CanDriver::getErrorCounters() const
+{
+    return LPC_C_CAN0->CANEC & 0x7FFF;
 }
 
 /**
@@ -16,32 +16,58 @@ using namespace std;
 
 typedef bool (*UartRecvHandler)(uint8_t ch);
 
+const uint32_t TX_RING_LEN = 2048; // power of 2
+
 class CmdUart {
 public:
     static CmdUart* instance();
     static void configure();
     void irqHandler();
+    void dmaIrqHandler();
     void init(uint32_t speed);
+    void setSpeed(uint32_t speed);
+    uint32_t speed() const { return speed_; }
     void send(const util::string& str);
-    void send(uint8_t ch);
+    void send(const char* str, uint32_t len);
+    bool send(uint8_t ch);
+    void put(uint8_t ch);
+    void put(const char* str, uint32_t len);
+    void commit();
+    void flush();
     bool ready() const { return ready_; }
     void ready(bool val) { ready_ = val; }
     void handler(UartRecvHandler handler) { handler_ = handler; }
     void monitor(bool val);
+    void capture(bool val);
+    bool captured(uint8_t& ch);
     bool isMonitorExit() const { return monitorExit_; }
 private:
     CmdUart();
+    void initDma();
+    void startTx();
+    void txComplete();
     void txIrqHandler();
     void rxIrqHandler();
+    uint32_t txFree() const { return (TX_RING_LEN - 1) - ((txWrite_ - txTail_) & (TX_RING_LEN - 1)); }
+    static void dmaCallback(uint32_t err, uint32_t intb);
 
-    char txData_[TX_BUFFER_LEN * 3];
-    util::string    rdData_;
-    uint16_t        txLen_;
-    uint16_t        txPos_;
-    volatile bool   ready_;
-    UartRecvHandler handler_;
-    bool            monitor_;
-    volatile bool   monitorExit_;
+    uint8_t           txRing_[TX_RING_LEN];
+    volatile uint32_t txHead_;
+    volatile uint32_t txTail_;
+    volatile uint32_t txDmaLen_;
+    volatile uint32_t txWrite_;  // uncommitted write position
+    uint8_t           echo_[4];  // echo deferred while the ring is open
+    volatile uint32_t echoLen_;
+    volatile bool     txOpen_;
+    void*             dmaHandle_;
+    util::string      rdData_;
+    uint32_t          speed_;
+    volatile int32_t  captureChar_;
+    bool              capture_;
+    volatile bool     ready_;
+    UartRecvHandler   handler_;
+    bool              monitor_;
+    volatile bool     monitorExit_;
 };
 
 
@@ -18,12 +18,28 @@ const int RxPort = 0;
 const int TxPort = 0;
 const uint32_t PinAssign = ((RxPin << 8) + (RxPort * 32)) | (TxPin  + (TxPort * 32));
 
+const uint8_t  TxDmaChannel = 1;      // USART0_TX_DMA request line
+const uint32_t DmaMaxXfer = 1024;     // max number of transfers in one DMA task
+const uint32_t DmaMemLen = 0x200;     // ROM driver RAM, channel descriptor table included
+
+// The ROM driver places the channel descriptor table at the start of its RAM
+static uint8_t dmaMem[DmaMemLen] __attribute__ ((aligned(512)));
+static uint8_t dmaTask[16] __attribute__ ((aligned(16)));
+
 /**
  * Constructor
  */
 CmdUart::CmdUart()
-  : txLen_(0),
-    txPos_(0),
+  : txHead_(0),
+    txTail_(0),
+    txDmaLen_(0),
+    txWrite_(0),
+    echoLen_(0),
+    txOpen_(false),
+    dmaHandle_(0),
+    speed_(0),
+    captureChar_(-1),
+    capture_(false),
     ready_(false),
     handler_(0),
     monitor_(false),
@@ -56,6 +72,24 @@ void CmdUart::configure()
 
     LPC_SWM->PINASSIGN0 &= 0xFFFF0000;
     LPC_SWM->PINASSIGN0 |= PinAssign;
+
+    // Enable DMA clock
+    LPC_SYSCON->SYSAHBCLKCTRL0 |=  (1 << 20);
+    LPC_SYSCON->PRESETCTRL0    |=  (1 << 20);
+    LPC_SYSCON->PRESETCTRL0    &= ~(1 << 20);
+}
+
+/**
+ * Setup the ROM DMA driver for UART0 TX, fall back to the TXRDY
+ * interrupt if the driver requires more memory than we have reserved
+ */
+void CmdUart::initDma()
+{
+    if (LPC_DMAD_API->dma_get_mem_size() > DmaMemLen)
+        return;
+
+    dmaHandle_ = LPC_DMAD_API->dma_setup(LPC_DMA_BASE, dmaMem);
+    NVIC_EnableIRQ(DMA_IRQn);
 }
 
 /**
@@ -72,6 +106,10 @@ void CmdUart::init(uint32_t speed)
 
     NVIC_DisableIRQ(UART0_IRQn);
 
+    if (!dmaHandle_) {
+        initDma();
+    }
+
     // Setup the UART handle
     UART_HANDLE_T uartHandle =
         LPC_UARTD_API->uart_setup(reinterpret_cast<uint32_t>(LPC_USART0), uartMem);
@@ -86,27 +124,139 @@ void CmdUart::init(uint32_t speed)
 
     // Initialize the UART with the configuration parameters
     LPC_UARTD_API->uart_init(uartHandle, &cfg);
+    speed_ = speed;
 
     NVIC_EnableIRQ(UART0_IRQn);
     UARTIntEnable(LPC_USART0, UART_INTEN_RXRDY);
 }
 
 /**
- * CmdUart TX handler
+ * Change the speed without reinitializing UART, the caller is responsible
+ * for flushing the TX ring. The shared fractional generator is left untouched
+ * since it also clocks the ECU UART, the divisor is split between OSR and BRG
+ * with the largest oversampling giving less than 1% error,
+ * i.e. 500K: 16 x 9, 1M: 12 x 6, 2M: 12 x 3 @72MHz
+ * @parameter[in] speed Speed to configure
  */
-void CmdUart::txIrqHandler()
+void CmdUart::setSpeed(uint32_t speed)
 {
-    // Fill TX until full or until TX buffer is empty
-    if (txPos_ < txLen_) {
-        if (UARTGetStatus(LPC_USART0) & UART_STAT_TXRDY) {
-            UARTSendByte(LPC_USART0, txData_[txPos_++]);
+    const uint32_t MaxErrorPermille = 10;
+    uint32_t pclk = SystemCoreClock / LPC_SYSCON->UARTCLKDIV;
+    uint32_t bestOsr = 16, bestBrg = 1, bestError = 0xFFFFFFFF;
+
+    for (uint32_t osr = 16; osr >= 5; osr--) {
+        uint32_t brg = (pclk + (osr * speed) / 2) / (osr * speed);
+        if (brg == 0 || brg > 0x10000)
+            continue;
+        uint32_t actual = pclk / (osr * brg);
+        uint32_t error = (actual > speed ? actual - speed : speed - actual) * 1000 / speed;
+        if (error < bestError) {
+            bestError = error;
+            bestOsr = osr;
+            bestBrg = brg;
         }
+        if (error < MaxErrorPermille)
+            break;
     }
-    else {
-        UARTIntDisable(LPC_USART0, UART_INTEN_TXRDY);
+
+    UARTSetDivisors(LPC_USART0, bestBrg - 1, bestOsr - 1);
+    speed_ = speed;
+}
+
+/**
+ * Start the transmission of the next contiguous ring block,
+ * must be called with interrupts disabled
+ */
+void CmdUart::startTx()
+{
+    if (txDmaLen_ || txHead_ == txTail_)
+        return;
+
+    // The TXRDY fallback is draining the ring
+    if (UARTGetIntsEnabled(LPC_USART0) & UART_INTEN_TXRDY)
+        return;
+
+    if (!dmaHandle_) {
+        UARTIntEnable(LPC_USART0, UART_INTEN_TXRDY);
+        return;
+    }
+
+    uint32_t len = (txHead_ > txTail_) ? (txHead_ - txTail_) : (TX_RING_LEN - txTail_);
+    if (len > DmaMaxXfer) {
+        len = DmaMaxXfer;
+    }
+    txDmaLen_ = len;
+
+    DMA_CHANNEL_T channel = {
+        DMA_ROM_CH_EVENT_PERIPH, // UART TXRDY paced
+        0,                       // No hardware trigger
+        0,                       // Highest priority
+        0,
+        dmaCallback
+    };
+
+    DMA_TASK_T task;
+    task.ch_num = TxDmaChannel;
+    task.config = DMA_ROM_TASK_CFG_SW_TRIGGER | DMA_ROM_TASK_CFG_CLR_TRIGGER | DMA_ROM_TASK_CFG_SEL_INTA;
+    task.data_type = DMA_ROM_TASK_DATA_WIDTH_8 | DMA_ROM_TASK_SRC_INC_1 | DMA_ROM_TASK_DEST_INC_0;
+    task.data_length = len - 1;
+    task.src = reinterpret_cast<uint32_t>(&txRing_[txTail_ + len - 1]); // end address
+    task.dst = reinterpret_cast<uint32_t>(&LPC_USART0->TXDATA);
+    task.task_addr = reinterpret_cast<uint32_t>(dmaTask);
+
+    ErrorCode_t sts = LPC_DMAD_API->dma_init(static_cast<DMA_HANDLE_T*>(dmaHandle_), &channel, &task);
+    if (sts != LPC_OK) {
+        // Send this chunk by TXRDY interrupt, DMA will be tried again next time
+        txDmaLen_ = 0;
+        UARTIntEnable(LPC_USART0, UART_INTEN_TXRDY);
+    }
+}
+
+/**
+ * DMA block completed, release the block and start the next one
+ */
+void CmdUart::txComplete()
+{
+    txTail_ = (txTail_ + txDmaLen_) & (TX_RING_LEN - 1);
+    txDmaLen_ = 0;
+    startTx();
+}
+
+/**
+ * ROM DMA driver callback, called from DMA ISR
+ * @param[in] err Error code
+ * @param[in] intb INTA/INTB flag
+ */
+void CmdUart::dmaCallback(uint32_t err, uint32_t intb)
+{
+    instance()->txComplete();
+}
+
+/**
+ * CmdUart DMA handler
+ */
+void CmdUart::dmaIrqHandler()
+{
+    if (dmaHandle_) {
+        LPC_DMAD_API->dma_isr(static_cast<DMA_HANDLE_T*>(dmaHandle_));
     }
 }
 
+/**
+ * CmdUart TX handler, used if DMA is not available or failed to start
+ */
+void CmdUart::txIrqHandler()
+{
+    // Fill TX until full or until TX ring is empty
+    while (txHead_ != txTail_) {
+        if (!(UARTGetStatus(LPC_USART0) & UART_STAT_TXRDY))
+            return;
+        UARTSendByte(LPC_USART0, txRing_[txTail_]);
+        txTail_ = (txTail_ + 1) & (TX_RING_LEN - 1);
+    }
+    UARTIntDisable(LPC_USART0, UART_INTEN_TXRDY);
+}
+
 /**
  * CmdUart RX handler
  */
@@ -116,8 +266,13 @@ void CmdUart::rxIrqHandler()
         return;
 
     uint8_t ch = UARTReadByte(LPC_USART0);
-    if (handler_ && !monitor_) {
-        ready_ = (*handler_)(ch);
+    if (capture_) {
+        captureChar_ = ch;
+    }
+    else if (handler_ && !monitor_) {
+        if ((*handler_)(ch)) { // stays set until the main loop takes the command
+            ready_ = true;
+        }
     }
     else if(monitor_) {
         monitorExit_ = true;
@@ -138,33 +293,128 @@ void CmdUart::irqHandler()
 }
 
 /**
- * Send one character, blocking call for echo purposes
+ * Queue one character, non-blocking call for echo purposes. If the main
+ * loop is writing to the ring, the character is deferred until commit,
+ * the character is dropped if there is no space
  * @parameter[in] ch Character to send
+ * @return true if queued
  */
-void CmdUart::send(uint8_t ch) 
+bool CmdUart::send(uint8_t ch) 
 {
-    while (!(UARTGetStatus(LPC_USART0) & UART_STAT_TXRDY))
-        ;
-    UARTSendByte(LPC_USART0, ch);
+    bool queued = false;
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    if (txOpen_) {
+        if (echoLen_ < sizeof(echo_)) {
+            echo_[echoLen_++] = ch;
+            queued = true;
+        }
+    }
+    else if (txFree()) {
+        txRing_[txWrite_] = ch;
+        txWrite_ = (txWrite_ + 1) & (TX_RING_LEN - 1);
+        txHead_ = txWrite_;
+        startTx();
+        queued = true;
+    }
+    __set_PRIMASK(primask);
+    return queued;
+}
+
+/**
+ * Write one character to the ring without starting the transmission,
+ * wait for the ring space only if the ring is full
+ * @parameter[in] ch Character to write
+ */
+void CmdUart::put(uint8_t ch)
+{
+    for (;;) {
+        txOpen_ = true; // from now on the RX interrupt does not touch txWrite_
+        if (txFree())
+            break;
+        commit();
+    }
+    txRing_[txWrite_] = ch;
+    txWrite_ = (txWrite_ + 1) & (TX_RING_LEN - 1);
+}
+
+/**
+ * Publish the characters written by put() and start the transmission,
+ * append the deferred echo characters afterwards
+ */
+void CmdUart::commit()
+{
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    for (uint32_t i = 0; i < echoLen_ && txFree(); i++) {
+        txRing_[txWrite_] = echo_[i];
+        txWrite_ = (txWrite_ + 1) & (TX_RING_LEN - 1);
+    }
+    echoLen_ = 0;
+    txHead_ = txWrite_;
+    txOpen_ = false;
+    startTx();
+    __set_PRIMASK(primask);
+}
+
+/**
+ * Write the data to the ring without starting the transmission,
+ * wait for the ring space only if the ring is full
+ * @parameter[in] str Data to write
+ * @parameter[in] len Data length
+ */
+void CmdUart::put(const char* str, uint32_t len)
+{
+    while (len) {
+        txOpen_ = true;
+        uint32_t space = txFree();
+        if (!space) {
+            commit();
+            continue;
+        }
+        uint32_t cnt = (len < space) ? len : space;
+        uint32_t first = TX_RING_LEN - txWrite_;
+        if (first > cnt) {
+            first = cnt;
+        }
+        memcpy(txRing_ + txWrite_, str, first);
+        memcpy(txRing_, str + first, cnt - first);
+        txWrite_ = (txWrite_ + cnt) & (TX_RING_LEN - 1);
+        str += cnt;
+        len -= cnt;
+    }
+}
+
+/**
+ * Queue the data asynch, wait for the ring space only if the ring is full
+ * @parameter[in] str Data to send
+ * @parameter[in] len Data length
+ */
+void CmdUart::send(const char* str, uint32_t len)
+{
+    put(str, len);
+    commit();
 }
 
 /**
  * Send the string asynch
- * Note: we do truncate the string up to txLen_ characters (192 chars)
  * @parameter[in] str String to send
  */
 void CmdUart::send(const util::string& str)
 {
-    // wait for TX interrupt disabled when the previous transmission completed
-    while ((UARTGetIntsEnabled(LPC_USART0) & UART_INTEN_TXRDY)) {
-        ;
-    }
+    send(str.c_str(), str.length());
+}
 
-    // start the new transmission 
-    txPos_ = 0;
-    txLen_ = str.length();
-    memcpy(txData_, str.c_str(), txLen_);
-    UARTIntEnable(LPC_USART0, UART_INTEN_TXRDY);
+/**
+ * Wait until the TX ring is drained and the last character is out
+ */
+void CmdUart::flush()
+{
+    commit();
+    while (txHead_ != txTail_ || txDmaLen_)
+        ;
+    while (!(UARTGetStatus(LPC_USART0) & UART_STAT_TXIDLE))
+        ;
 }
 
 void CmdUart::monitor(bool val)
@@ -178,6 +428,32 @@ void CmdUart::monitor(bool val)
     monitorExit_ = false;
 }
 
+/**
+ * Route the received characters to the capture slot instead of the handler,
+ * used for baud rate switch handshake
+ * @parameter[in] val Capture on/off
+ */
+void CmdUart::capture(bool val)
+{
+    captureChar_ = -1;
+    capture_ = val;
+}
+
+/**
+ * Get the captured character
+ * @parameter[out] ch The character
+ * @return true if character was received
+ */
+bool CmdUart::captured(uint8_t& ch)
+{
+    int32_t val = captureChar_;
+    if (val < 0)
+        return false;
+    captureChar_ = -1;
+    ch = val;
+    return true;
+}
+
 /**
  * UART0 IRQ Handler, redirect to irqHandler
  */
@@ -186,3 +462,11 @@ extern "C" void UART0_IRQHandler(void)
     if (CmdUart::instance())
         CmdUart::instance()->irqHandler();
 }
+
+/**
+ * DMA IRQ Handler, redirect to dmaIrqHandler
+ */
+extern "C" void DMA_IRQHandler(void)
+{
+    CmdUart::instance()->dmaIrqHandler();
+}
@@ -1,7 +1,7 @@
 /**
  * See the file LICENSE for redistribution information.
  *
- * Copyright (c) 2009-2016 ObdDiag.Net. All rights reserved.
+ * Copyright (c) 2009-2018 ObdDiag.Net. All rights reserved.
  *
  */
 
@@ -13,21 +13,66 @@
 
 using namespace std;
 
+class PeriodicTimer;
+
+const uint32_t ECU_RX_RING_LEN = 256; // power of 2
+const uint32_t ECU_TX_LEN      = 64;
+
 class EcuUart {
 public:
+    // Transmit status
+    const static int TX_OK        = 0;
+    const static int TX_BUSY      = 1;
+    const static int TX_COLLISION = 2; // the echo byte differs
+    const static int TX_NO_ECHO   = 3; // wiring problem
+    
     static EcuUart* instance();
     static void configure();
     void init(uint32_t speed);
-    void send(uint8_t byte);
+    void irqHandler();
+    bool send(const uint8_t* data, uint32_t len, uint32_t p4Time);
+    bool isSending() const { return txStatus_ == TX_BUSY; }
+    int  txStatus() const { return txStatus_; }
+    uint32_t txEndTime() const { return txEndTime_; }
     uint8_t get();
-    bool getEcho(uint8_t byte);
-    bool ready();
+    bool getTime(uint32_t& time) const;
+    bool ready() const { return rxHead_ != rxTail_; } // received bytes in the ring
+    void flush() { rxTail_ = rxHead_; }
     void clear();
     void setBitBang(bool val);
     void setBit(uint32_t val);
     uint32_t getBit();
+    void startSlowInit(uint8_t byte);
+    void stopSlowInit();
+    bool isSlowInitDone() const { return !slowInit_; }
+    bool slowInitStatus() const { return slowInitSts_; }
+    uint32_t slowInitRemaining() const;
 private:
-    EcuUart() {}
+    EcuUart();
+    static void slowInitCallback();
+    static void txCallback();
+    void nextSlowInitBit();
+    void sendNext();
+    bool checkEcho(uint8_t byte);
+    void txTimeout();
+    uint8_t           txData_[ECU_TX_LEN];
+    uint32_t          txLen_;
+    volatile uint32_t txPos_;    // the byte waiting for the echo
+    uint32_t          txP4_;     // interbyte time, us
+    uint32_t          echoTime_; // echo timeout, us
+    volatile bool     txGap_;    // waiting P4 before the next byte
+    volatile int      txStatus_;
+    volatile uint32_t txEndTime_; // the last echo time, us
+    PeriodicTimer*    txTimer_;
+    uint8_t           rxData_[ECU_RX_RING_LEN];
+    uint32_t          rxTime_[ECU_RX_RING_LEN]; // receive time, us
+    volatile uint32_t rxHead_;
+    volatile uint32_t rxTail_;
+    PeriodicTimer*    bitTimer_;
+    volatile uint32_t bits_;    // the bits left to send, LSB first
+    volatile int      bitNum_;
+    volatile bool     slowInit_;
+    volatile bool     slowInitSts_;
 };
 
 #endif //__ECU_UART_H__
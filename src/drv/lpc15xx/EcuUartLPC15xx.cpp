@@ -1,7 +1,7 @@
 /**
  * See the file LICENSE for redistribution information.
  *
- * Copyright (c) 2009-2017 ObdDiag.Net. All rights reserved.
+ * Copyright (c) 2009-2018 ObdDiag.Net. All rights reserved.
  *
  */
 
@@ -9,6 +9,7 @@
 #include "UartLPC15xx.h"
 #include "EcuUart.h"
 #include "GpioDrv.h"
+#include "Timer.h"
 
 using namespace std;
 
@@ -17,6 +18,8 @@ const int RxPin  = 7;
 const int RxPort = 0;
 const int TxPort = 0;
 const uint32_t PinAssign = ((RxPin << 16) + (RxPort * 32)) | ((TxPin << 8)  + (TxPort * 32));
+const uint32_t SlowInitBitInterval = 200; // 5bps
+const int SlowInitBits = 10;              // start + 8 data + stop
 
 
 //#define INVERT_OUTPUT // Invert output for simple transistor-based K-line driver
@@ -32,6 +35,20 @@ EcuUart* EcuUart::instance()
     return &instance;;
 }
 
+/**
+ * Construct EcuUart object
+ */
+EcuUart::EcuUart() : rxHead_(0), rxTail_(0), bits_(0), bitNum_(0), slowInit_(false), slowInitSts_(true)
+{
+    MicroTimer::instance(); // The receive timestamps clock
+    txLen_ = txPos_ = txP4_ = txEndTime_ = 0;
+    echoTime_ = 3000;
+    txGap_ = false;
+    txStatus_ = TX_OK;
+    txTimer_ = new PeriodicTimer(txCallback, PeriodicTimer::TX_CHANNEL);
+    bitTimer_ = new PeriodicTimer(slowInitCallback, PeriodicTimer::ISO_CHANNEL);
+}
+
 /**
  * Configure UART1
  */
@@ -97,58 +114,165 @@ void EcuUart::init(uint32_t speed)
 #ifdef INVERT_OUTPUT
     LPC_USART1->CFG |= (0x1 << 23); // TXPOL flag
 #endif
+
+    // Echo timeout, 3 bytes time and some margin
+    echoTime_ = 30000000 / speed + 1000;
+    
+    // Receive by interrupt
+    txTimer_->stop();
+    txStatus_ = TX_OK;
+    rxHead_ = rxTail_;
+    NVIC_EnableIRQ(UART1_IRQn);
+    UARTIntEnable(LPC_USART1, UART_INTEN_RXRDY);
+}
+
+/**
+ * Put the received byte and the timestamp to the ring, drop the framing/parity errors
+ */
+void EcuUart::irqHandler()
+{
+    uint32_t time = MicroTimer::instance()->value();
+    uint32_t status = UARTGetStatus(LPC_USART1);
+    if (!(status & UART_STAT_RXRDY))
+        return;
+    
+    uint8_t byte = UARTReadByte(LPC_USART1);
+    if (status & (UART_STAT_FRM_ERRINT | UART_STAT_PAR_ERRINT)) {
+        LPC_USART1->STAT = UART_STAT_FRM_ERRINT | UART_STAT_PAR_ERRINT;
+        if (txStatus_ == TX_BUSY && !txGap_) {
+            checkEcho(~txData_[txPos_]); // Collision
+        }
+        return;
+    }
+    
+    // Our own byte echo while transmitting
+    if (txStatus_ == TX_BUSY && !txGap_) {
+        checkEcho(byte);
+        txEndTime_ = time;
+        return;
+    }
+    
+    uint32_t head = rxHead_;
+    uint32_t next = (head + 1) & (ECU_RX_RING_LEN - 1);
+    if (next == rxTail_)
+        return; // Full, drop it
+    rxData_[head] = byte;
+    rxTime_[head] = time;
+    __DMB();
+    rxHead_ = next;
+}
+
+/**
+ * Start sending the bytes, the next byte is sent P4 after the previous byte echo.
+ * Non-blocking, check isSending() and txStatus() for completion.
+ * @parameter[in] data The bytes to send
+ * @parameter[in] len The number of bytes
+ * @parameter[in] p4Time The interbyte time P4, us
+ * @return true if started, false if busy or too long
+ */
+bool EcuUart::send(const uint8_t* data, uint32_t len, uint32_t p4Time)
+{
+    if (txStatus_ == TX_BUSY || len == 0 || len > ECU_TX_LEN)
+        return false;
+    
+    // A byte received before the first one is sent is not the echo, drop it
+    NVIC_DisableIRQ(UART1_IRQn);
+    if (UARTGetStatus(LPC_USART1) & UART_STAT_RXRDY) {
+        UARTReadByte(LPC_USART1);
+    }
+    memcpy(txData_, data, len);
+    txLen_ = len;
+    txPos_ = 0;
+    txP4_ = p4Time;
+    txGap_ = false;
+    txStatus_ = TX_BUSY;
+    sendNext();
+    NVIC_EnableIRQ(UART1_IRQn);
+    return true;
 }
 
 /**
- * Send byte, blocking call pending on UART1 send ready status
- * @parameter[in] byte Byte to sent
+ * Send the byte at txPos_, start the echo timeout
  */
-void EcuUart::send(uint8_t byte)
+void EcuUart::sendNext()
 {
-    while (!(UARTGetStatus(LPC_USART1) & UART_STAT_TXRDY))
-        ;
-    UARTSendByte(LPC_USART1, byte);
+    txGap_ = false;
+    txTimer_->startOnce(echoTime_);
+    UARTSendByte(LPC_USART1, txData_[txPos_]);
+}
+
+/**
+ * Compare the echo byte, as USART TX and RX pins are interconnected thru MC33660
+ * @parameter[in] byte The received byte
+ * @return true if matched, false on collision
+ */
+bool EcuUart::checkEcho(uint8_t byte)
+{
+    if (byte != txData_[txPos_]) {
+        txTimer_->stop();
+        txStatus_ = TX_COLLISION;
+        return false;
+    }
+    if (++txPos_ == txLen_) {
+        txTimer_->stop();
+        txStatus_ = TX_OK;
+    }
+    else if (txP4_ == 0) {
+        sendNext();
+    }
+    else {
+        txGap_ = true;
+        txTimer_->startOnce(txP4_);
+    }
+    return true;
+}
+
+/**
+ * P4 elapsed, send the next byte, or the echo timeout expired
+ */
+void EcuUart::txTimeout()
+{
+    if (txStatus_ != TX_BUSY)
+        return;
+    if (txGap_) {
+        sendNext();
+    }
+    else {
+        txStatus_ = TX_NO_ECHO;
+    }
 }
 
 /**
- * Checking EcuUart receive ready flag
- * @return The flag
+ * Transmit timer callback, called from MRT interrupt
  */
-bool EcuUart::ready()
+void EcuUart::txCallback()
 {
-    return (UARTGetStatus(LPC_USART1) & UART_STAT_RXRDY);
+    instance()->txTimeout();
 }
 
 /*
- * Reading a byte from USART
+ * Reading a byte from the receive ring, check ready() first
  * @return The byte received
  */
 uint8_t EcuUart::get()
 {
-    return UARTReadByte(LPC_USART1);
+    uint32_t tail = rxTail_;
+    uint8_t byte = rxData_[tail];
+    rxTail_ = (tail + 1) & (ECU_RX_RING_LEN - 1);
+    return byte;
 }
 
 /**
- * As USART TX and RX pins are interconnected thru MC33660, sending a byte will always echo it back
- * just wait and read it back.
- * @parameter[in] byte The already sent byte to compare echo with
- * @return The completion status
+ * Get the receive timestamp of the next byte, not removing it
+ * @param[out] time The MicroTimer value
+ * @return true if the byte is there, false otherwise
  */
-bool EcuUart::getEcho(uint8_t byte)
+bool EcuUart::getTime(uint32_t& time) const
 {
-    const uint32_t EchoTimeout = 20; // Using 20ms echo timeout
-
-    // Use the SysTick to generate the timeout
-    SysTick->LOAD = EchoTimeout * (SystemCoreClock / 1000);
-    SysTick->VAL  = 0;
-    SysTick->CTRL = SysTick_CTRL_CLKSOURCE_Msk | SysTick_CTRL_ENABLE_Msk;
-
-    while (!ready()) {
-        if (SysTick->CTRL & 0x10000) // check timeout
-            return false;
-    }
-    uint8_t echo = get();
-    return (echo == byte);
+    if (!ready())
+        return false;
+    time = rxTime_[rxTail_];
+    return true;
 }
 
 /*
@@ -190,13 +314,89 @@ uint32_t EcuUart::getBit()
 }
 
 /**
- * Clear Framing/Parity errors, if any, by reading RXDATA
+ * Clear Framing/Parity errors, if any, the bytes are dropped by irqHandler
  */
 void EcuUart::clear()
 {
-    // Clear FRAMERR and PARITYERR by reading RXDATA
-    if (LPC_USART1->STAT & 0x6000) {
-        LPC_USART1->STAT |= 0x6000;
-        UARTReadByte(LPC_USART1);
+    LPC_USART1->STAT = UART_STAT_FRM_ERRINT | UART_STAT_PAR_ERRINT;
+}
+
+/**
+ * Start sending the byte at 5bps in the background, driven by MRT interrupt
+ * @parameter[in] byte The ECU address byte
+ */
+void EcuUart::startSlowInit(uint8_t byte)
+{
+    uint32_t ch = byte;
+    ch <<= 1;    // Shift to accommodate start bit
+    ch |= 0x200; // Add stop bit
+    
+    // Disable USART
+    setBitBang(true);
+
+    slowInit_ = true;
+    slowInitSts_ = true;
+    bitNum_ = 1;
+    setBit(ch & 0x01);
+    bits_ = ch >> 1;
+    bitTimer_->start(SlowInitBitInterval);
+}
+
+/**
+ * Abort the 5bps byte, release the K-line and enable USART
+ */
+void EcuUart::stopSlowInit()
+{
+    if (!slowInit_)
+        return;
+    bitTimer_->stop();
+    setBit(1);
+    setBitBang(false);
+    slowInit_ = false;
+}
+
+/**
+ * The time left for the 5bps byte
+ * @return The remaining time in ms
+ */
+uint32_t EcuUart::slowInitRemaining() const
+{
+    return slowInit_ ? (SlowInitBits + 1 - bitNum_) * SlowInitBitInterval : 0;
+}
+
+/**
+ * 5bps bit timer callback, called from MRT interrupt
+ */
+void EcuUart::slowInitCallback()
+{
+    instance()->nextSlowInitBit();
+}
+
+/**
+ * Send the next 5bps bit, enable USART after the stop bit
+ */
+void EcuUart::nextSlowInitBit()
+{
+    if (bitNum_ < SlowInitBits) {
+        setBit(bits_ & 0x01);
+        bits_ >>= 1;
+        bitNum_++;
+        return;
     }
+    bitTimer_->stop();
+    
+    // Get the feedback status, the last bit (stop bit)
+    slowInitSts_ = (getBit() != 0); // Wiring error, no +12V power?
+    
+    // Enable USART, ready for the sync byte
+    setBitBang(false);
+    slowInit_ = false;
+}
+
+/**
+ * UART1 IRQ Handler, redirect to irqHandler
+ */
+extern "C" void UART1_IRQHandler(void)
+{
+    EcuUart::instance()->irqHandler();
 }
@@ -0,0 +1,24 @@
+/**
+ * See the file LICENSE for redistribution information.
+ *
+ * Copyright (c) 2009-2018 ObdDiag.Net. All rights reserved.
+ *
+ */
+
+#ifndef __EEPROM_DRIVER_H__ 
+#define __EEPROM_DRIVER_H__
+
+#include <cstdint>
+
+using namespace std;
+
+// On-chip EEPROM, accessed through the IAP ROM calls
+//
+class EepromDriver {
+public:
+    const static uint32_t SIZE = 4032; // 4K, the top 64 bytes are reserved
+    static bool read(uint32_t addr, uint8_t* data, uint32_t len);
+    static bool write(uint32_t addr, const uint8_t* data, uint32_t len);
+};
+
+#endif //__EEPROM_DRIVER_H__
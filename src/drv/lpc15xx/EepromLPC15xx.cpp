@@ -0,0 +1,59 @@
+/**
+ * See the file LICENSE for redistribution information.
+ *
+ * Copyright (c) 2009-2018 ObdDiag.Net. All rights reserved.
+ *
+ */
+
+#include <LPC15xx.h>
+#include <romapi_15xx.h>
+#include "EepromDriver.h"
+
+/**
+ * IAP API call for EEPROM read/write
+ * @param[in] cmd The IAP command, IAP_EEPROM_READ or IAP_EEPROM_WRITE
+ * @param[in] addr The EEPROM address
+ * @param[in] data The RAM buffer
+ * @param[in] len The number of bytes
+ * @return true if the command succeeded, false otherwise
+ */
+static bool IAPEepromCmd(uint32_t cmd, uint32_t addr, const uint8_t* data, uint32_t len)
+{
+    unsigned int command[5], result[4];
+
+    if (addr + len > EepromDriver::SIZE)
+        return false;
+    
+    command[0] = cmd;
+    command[1] = addr;
+    command[2] = reinterpret_cast<uint32_t>(data);
+    command[3] = len;
+    command[4] = SystemCoreClock / 1000; // kHz
+    ((IAP_ENTRY_T) IAP_ENTRY_LOCATION)(command , result);
+    
+    return result[0] == IAP_CMD_SUCCESS;
+}
+
+/**
+ * Read the bytes from EEPROM
+ * @param[in] addr The EEPROM address
+ * @param[out] data The buffer to read to
+ * @param[in] len The number of bytes
+ * @return true if succeeded, false otherwise
+ */
+bool EepromDriver::read(uint32_t addr, uint8_t* data, uint32_t len)
+{
+    return IAPEepromCmd(IAP_EEPROM_READ, addr, data, len);
+}
+
+/**
+ * Write the bytes to EEPROM, takes a few ms per 64 byte page
+ * @param[in] addr The EEPROM address
+ * @param[in] data The buffer to write from
+ * @param[in] len The number of bytes
+ * @return true if succeeded, false otherwise
+ */
+bool EepromDriver::write(uint32_t addr, const uint8_t* data, uint32_t len)
+{
+    return IAPEepromCmd(IAP_EEPROM_WRITE, addr, data, len);
+}
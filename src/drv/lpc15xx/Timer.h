@@ -35,13 +35,30 @@ private:
     LongTimer();
 };
 
-// For use with Rx/Tx LEDs
+// Free running microsecond clock, wraps in ~71 minutes,
+// compare the values as signed differences
+class MicroTimer {
+public:
+    static MicroTimer* instance();
+    uint32_t value() const { return LPC_SCT1->COUNT; }
+private:
+    MicroTimer();
+};
+
+// MRT channel interrupt timer, channel 3 for use with Rx/Tx LEDs
 typedef void (*PeriodicCallbackT)();
 class PeriodicTimer {
 public:
-    PeriodicTimer(PeriodicCallbackT callback);
+    const static int MRT_CHANNELS = 4;
+    const static int LED_CHANNEL  = 3;
+    const static int ISO_CHANNEL  = 0; // ISO 9141 5bps init
+    const static int TX_CHANNEL   = 1; // K-line transmit, P4 and echo timeout
+    PeriodicTimer(PeriodicCallbackT callback, int channel = LED_CHANNEL);
     void start(uint32_t interval);
+    void startOnce(uint32_t usec);
     void stop();
+private:
+    int channel_;
 };
 
 #endif //__TIMER_H__
@@ -126,27 +126,75 @@ LongTimer* LongTimer::instance()
     return &timer;
 }
 
-static PeriodicCallbackT irqCallback;
+/**
+ * Construct the MicroTimer object, SCT1 unified counter prescaled to 1MHz
+ */
+MicroTimer::MicroTimer()
+{
+    const uint32_t prescaler = (SystemCoreClock / 1000000) - 1;
+    
+    LPC_SCT1->CONFIG = (1 << 0);         // unified 32-bit timer, no limit
+    LPC_SCT1->CTRL = (1 << 2) | (1 << 3) | (prescaler << 5); // halt, clear, prescale
+    LPC_SCT1->CTRL &= ~(1 << 2);       // start SCT1
+}
+
+/**
+ * Instance method for MicroTimer object
+ * @return MicroTimer pointer
+ */
+MicroTimer* MicroTimer::instance()
+{
+    static MicroTimer timer;
+    return &timer;
+}
+
+// The MRT channel registers
+struct MrtChannel {
+    __IO uint32_t INTVAL;
+    __I  uint32_t TIMER;
+    __IO uint32_t CTRL;
+    __IO uint32_t STAT;
+};
+
+static PeriodicCallbackT irqCallbacks[PeriodicTimer::MRT_CHANNELS];
 
+/**
+ * Get the MRT channel registers
+ * @param[in] channel The channel number, 0..3
+ * @return The channel registers pointer
+ */
+static MrtChannel* GetMrtChannel(int channel)
+{
+    return reinterpret_cast<MrtChannel*>(LPC_MRT) + channel;
+}
+
+/**
+ * MRT interrupt handler, dispatch to the channel callbacks
+ */
 extern "C" void MRT_IRQHandler(void)
 {
     uint32_t irqFlag = LPC_MRT->IRQ_FLAG;
-    //LPC_MRT->IRQ_FLAG = irqFlag;
 
-    if ((irqFlag & 0x08) && irqCallback) {
-        LPC_MRT->IRQ_FLAG |= 0x08;
-        (*irqCallback)();
+    for (int i = 0; i < PeriodicTimer::MRT_CHANNELS; i++) {
+        uint32_t mask = (1 << i);
+        if (irqFlag & mask) {
+            LPC_MRT->IRQ_FLAG = mask; // Clear this channel flag only
+            if (irqCallbacks[i]) {
+                (*irqCallbacks[i])();
+            }
+        }
     }
 }
 
 /**
  * Construct the PeriodicTimer instance
  * @param[in] callback Timer callback handler
+ * @param[in] channel The MRT channel
  */
-PeriodicTimer::PeriodicTimer(PeriodicCallbackT callback)
+PeriodicTimer::PeriodicTimer(PeriodicCallbackT callback, int channel) : channel_(channel)
 {
-    irqCallback = callback;
-    LPC_MRT->CTRL3 = 0x0;
+    irqCallbacks[channel_] = callback;
+    GetMrtChannel(channel_)->CTRL = 0x0;
     NVIC_EnableIRQ(MRT_IRQn);
 }
 
@@ -157,9 +205,23 @@ PeriodicTimer::PeriodicTimer(PeriodicCallbackT callback)
 void PeriodicTimer::start(uint32_t interval)
 {
     uint32_t val = tickDiv * interval;
-    LPC_MRT->CTRL3 = 0x1;  // repeated mode with interrupt
-    LPC_MRT->STAT3 |= 0x1; // Clear interrupt flag
-    LPC_MRT->INTVAL3 = val | 0x80000000;
+    MrtChannel* mrt = GetMrtChannel(channel_);
+    mrt->CTRL = 0x1;  // repeated mode with interrupt
+    mrt->STAT |= 0x1; // Clear interrupt flag
+    mrt->INTVAL = val | 0x80000000;
+}
+
+/**
+ * Start the timer in one-shot mode
+ * @param[in] usec Timer interval in microseconds
+ */
+void PeriodicTimer::startOnce(uint32_t usec)
+{
+    uint32_t val = (SystemCoreClock / 1000000) * usec;
+    MrtChannel* mrt = GetMrtChannel(channel_);
+    mrt->CTRL = 0x3;  // one-shot mode with interrupt
+    mrt->STAT |= 0x1; // Clear interrupt flag
+    mrt->INTVAL = (val ? val : 1) | 0x80000000;
 }
 
 /**
@@ -167,5 +229,5 @@ void PeriodicTimer::start(uint32_t interval)
  */
 void PeriodicTimer::stop()
 {
-    LPC_MRT->CTRL3 = 0x0;
+    GetMrtChannel(channel_)->CTRL = 0x0;
 }
@@ -66,6 +66,11 @@ const uint32_t UART_INTEN_PARITYERR  = (0x01 << 14);	// Parity error interrupt
 const uint32_t UART_INTEN_RXNOISE    = (0x01 << 15);	// Received noise interrupt
 
 
+/**
+ * UART OSR register offset, missing in LPC_USART0_Type
+ */
+const uint32_t UART_OSR_OFFSET       = 0x28;
+
 inline void UARTIntEnable(LPC_USART0_Type *pUART, uint32_t intMask)
 {
     pUART->INTENSET = intMask;
@@ -115,5 +120,21 @@ inline void UART_Disable(LPC_USART0_Type *pUART)
     pUART->CFG &= ~UART_CFG_ENABLE;
 }
 
+/**
+ * Set the baud rate divisors, baud = U_PCLK / ((brg + 1) * (osr + 1))
+ * @param[in] pUART pointer to selected UARTx peripheral
+ * @param[in] brg BRG register value
+ * @param[in] osr OSR register value, 4..15
+ */
+inline void UARTSetDivisors(LPC_USART0_Type *pUART, uint32_t brg, uint32_t osr)
+{
+    volatile uint32_t* osrReg = reinterpret_cast<volatile uint32_t*>(
+        reinterpret_cast<uint32_t>(pUART) + UART_OSR_OFFSET);
+    UART_Disable(pUART);
+    *osrReg = osr;
+    pUART->BRG = brg;
+    UART_Enable(pUART);
+}
+
 #endif //__UART_LPC15xx_H__
 
@@ -33,6 +33,7 @@ struct CanMsgBuffer {
     uint8_t dlc;
     uint8_t data[8];
     uint8_t msgnum;
+    uint32_t seq;    // arrival sequence number
 };
 
 #endif //__CAN_MSG_BUFFER_H__
@@ -0,0 +1,50 @@
+/**
+ * See the file LICENSE for redistribution information.
+ *
+ * Copyright (c) 2009-2018 ObdDiag.Net. All rights reserved.
+ *
+ */
+
+#include "crc16.h"
+
+using namespace std;
+
+namespace util {
+
+/**
+ * Nibble-wise CRC table, polynomial 0x1021
+ */
+static const uint16_t CrcTable[16] = {
+    0x0000, 0x1021, 0x2042, 0x3063, 0x4084, 0x50A5, 0x60C6, 0x70E7,
+    0x8108, 0x9129, 0xA14A, 0xB16B, 0xC18C, 0xD1AD, 0xE1CE, 0xF1EF
+};
+
+/**
+ * Update CRC with one byte
+ * @param[in] byte The data byte
+ * @param[in] crc The current CRC value
+ * @return The updated CRC value
+ */
+uint16_t crc16(uint8_t byte, uint16_t crc)
+{
+    crc = (crc << 4) ^ CrcTable[(crc >> 12) ^ (byte >> 4)];
+    crc = (crc << 4) ^ CrcTable[(crc >> 12) ^ (byte & 0x0F)];
+    return crc;
+}
+
+/**
+ * Calculate CRC for the data block
+ * @param[in] data The data bytes
+ * @param[in] length The data length
+ * @param[in] crc The initial CRC value
+ * @return The CRC value
+ */
+uint16_t crc16(const uint8_t* data, uint32_t length, uint16_t crc)
+{
+    for (uint32_t i = 0; i < length; i++) {
+        crc = crc16(data[i], crc);
+    }
+    return crc;
+}
+
+}
@@ -0,0 +1,25 @@
+/**
+ * See the file LICENSE for redistribution information.
+ *
+ * Copyright (c) 2009-2018 ObdDiag.Net. All rights reserved.
+ *
+ */
+
+#ifndef __CRC16_H__ 
+#define __CRC16_H__
+
+#include <cstdint>
+
+using namespace std;
+
+namespace util {
+
+    const uint16_t CRC16_INIT = 0xFFFF;
+
+    // CRC-16/CCITT, polynomial 0x1021
+    uint16_t crc16(uint8_t byte, uint16_t crc);
+    uint16_t crc16(const uint8_t* data, uint32_t length, uint16_t crc = CRC16_INIT);
+
+}
+
+#endif //__CRC16_H__
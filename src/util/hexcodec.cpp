@@ -0,0 +1,148 @@
+/**
+ * See the file LICENSE for redistribution information.
+ *
+ * Copyright (c) 2009-2018 ObdDiag.Net. All rights reserved.
+ *
+ */
+
+#include <cstring>
+#include "hexcodec.h"
+
+using namespace std;
+
+namespace util {
+
+static constexpr int8_t HexDigitValue(int ch)
+{
+    return (ch >= '0' && ch <= '9') ? (ch - '0') :
+           (ch >= 'A' && ch <= 'F') ? (ch - 'A' + 10) :
+           (ch >= 'a' && ch <= 'f') ? (ch - 'a' + 10) : -1;
+}
+
+static constexpr uint16_t HexDigit(int val)
+{
+    return (val < 10) ? ('0' + val) : ('A' + val - 10);
+}
+
+static constexpr uint16_t HexPair(int byte)
+{
+    return HexDigit(byte >> 4) | (HexDigit(byte & 0x0F) << 8);
+}
+
+#define HEX_ROW(f, n) \
+    f(n + 0x0), f(n + 0x1), f(n + 0x2), f(n + 0x3), f(n + 0x4), f(n + 0x5), f(n + 0x6), f(n + 0x7), \
+    f(n + 0x8), f(n + 0x9), f(n + 0xA), f(n + 0xB), f(n + 0xC), f(n + 0xD), f(n + 0xE), f(n + 0xF)
+
+#define HEX_TABLE(f) \
+    HEX_ROW(f, 0x00), HEX_ROW(f, 0x10), HEX_ROW(f, 0x20), HEX_ROW(f, 0x30), \
+    HEX_ROW(f, 0x40), HEX_ROW(f, 0x50), HEX_ROW(f, 0x60), HEX_ROW(f, 0x70), \
+    HEX_ROW(f, 0x80), HEX_ROW(f, 0x90), HEX_ROW(f, 0xA0), HEX_ROW(f, 0xB0), \
+    HEX_ROW(f, 0xC0), HEX_ROW(f, 0xD0), HEX_ROW(f, 0xE0), HEX_ROW(f, 0xF0)
+
+constexpr int8_t HexDecodeTable[256] = { HEX_TABLE(HexDigitValue) };
+constexpr uint16_t HexEncodeTable[256] = { HEX_TABLE(HexPair) };
+
+static_assert(HexEncodeTable[0xA5] == ('A' | ('5' << 8)), "Wrong hex encode table");
+static_assert(HexDecodeTable['f'] == 15 && HexDecodeTable['G'] == -1, "Wrong hex decode table");
+
+/**
+ * Store 32-bit word to unaligned destination, little endian
+ */
+static inline void StoreWord(char* out, uint32_t val)
+{
+    memcpy(out, &val, sizeof(val));
+}
+
+/**
+ * Binary to hex ASCII conversion without spaces, "0102AB",
+ * 4 bytes are converted at once
+ * @param[in] bytes The byte array to convert
+ * @param[in] length The byte array length
+ * @param[out] out The output buffer, 2 * length chars, no null terminator
+ * @return The number of chars
+ */
+uint32_t hex_encode(const uint8_t* bytes, uint32_t length, char* out)
+{
+    char* p = out;
+    uint32_t i = 0;
+    for (; i + 4 <= length; i += 4, p += 8) {
+        uint32_t word;
+        memcpy(&word, bytes + i, sizeof(word));
+        StoreWord(p,     HexEncodeTable[word & 0xFF] | (HexEncodeTable[(word >> 8) & 0xFF] << 16));
+        StoreWord(p + 4, HexEncodeTable[(word >> 16) & 0xFF] | (HexEncodeTable[word >> 24] << 16));
+    }
+    for (; i < length; i++, p += 2) {
+        uint16_t pair = HexEncodeTable[bytes[i]];
+        p[0] = pair & 0xFF;
+        p[1] = pair >> 8;
+    }
+    return p - out;
+}
+
+/**
+ * Binary to hex ASCII conversion with spaces, "01 02 AB",
+ * 4 bytes are converted at once
+ * @param[in] bytes The byte array to convert
+ * @param[in] length The byte array length
+ * @param[out] out The output buffer, 3 * length chars, no null terminator
+ * @return The number of chars, no trailing space
+ */
+uint32_t hex_encode_spaced(const uint8_t* bytes, uint32_t length, char* out)
+{
+    const uint32_t Space = ' ';
+    char* p = out;
+    uint32_t i = 0;
+    for (; i + 4 <= length; i += 4, p += 12) {
+        uint32_t word;
+        memcpy(&word, bytes + i, sizeof(word));
+        uint32_t t0 = HexEncodeTable[word & 0xFF];
+        uint32_t t1 = HexEncodeTable[(word >> 8) & 0xFF];
+        uint32_t t2 = HexEncodeTable[(word >> 16) & 0xFF];
+        uint32_t t3 = HexEncodeTable[word >> 24];
+        StoreWord(p,     t0 | (Space << 16) | (t1 << 24));           // "XX X"
+        StoreWord(p + 4, (t1 >> 8) | (Space << 8) | (t2 << 16));     // "X XX"
+        StoreWord(p + 8, Space | (t3 << 8) | (Space << 24));         // " XX "
+    }
+    for (; i < length; i++, p += 3) {
+        uint16_t pair = HexEncodeTable[bytes[i]];
+        p[0] = pair & 0xFF;
+        p[1] = pair >> 8;
+        p[2] = ' ';
+    }
+    return (p != out) ? (p - out - 1) : 0; // Truncate the last space
+}
+
+/**
+ * Hex ASCII to binary conversion, the odd last digit is ignored,
+ * 4 digits are converted at once
+ * @param[in] str The hex digits
+ * @param[in] length The number of digits
+ * @param[out] bytes The output bytes
+ * @return The number of bytes, 0 if non hex digit found
+ */
+uint32_t hex_decode(const char* str, uint32_t length, uint8_t* bytes)
+{
+    const uint8_t* s = reinterpret_cast<const uint8_t*>(str);
+    uint32_t len = length / 2;
+    uint32_t i = 0;
+    for (; i + 2 <= len; i += 2, s += 4) {
+        int d0 = HexDecodeTable[s[0]];
+        int d1 = HexDecodeTable[s[1]];
+        int d2 = HexDecodeTable[s[2]];
+        int d3 = HexDecodeTable[s[3]];
+        if ((d0 | d1 | d2 | d3) < 0)
+            return 0;
+        bytes[i]     = (d0 << 4) | d1;
+        bytes[i + 1] = (d2 << 4) | d3;
+    }
+    if (i < len) {
+        int d0 = HexDecodeTable[s[0]];
+        int d1 = HexDecodeTable[s[1]];
+        if ((d0 | d1) < 0)
+            return 0;
+        bytes[i++] = (d0 << 4) | d1;
+    }
+    return i;
+}
+
+}
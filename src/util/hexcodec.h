@@ -0,0 +1,30 @@
+/**
+ * See the file LICENSE for redistribution information.
+ *
+ * Copyright (c) 2009-2018 ObdDiag.Net. All rights reserved.
+ *
+ */
+
+#ifndef __HEXCODEC_H__ 
+#define __HEXCODEC_H__
+
+#include <cstdint>
+
+using namespace std;
+
+namespace util {
+
+    // Hex digit value for every ASCII code, -1 for non hex digits
+    extern const int8_t HexDecodeTable[256];
+
+    // Two ASCII hex digits for every byte value, the first digit in the low byte
+    extern const uint16_t HexEncodeTable[256];
+
+    inline int hex_value(char ch) { return HexDecodeTable[static_cast<uint8_t>(ch)]; }
+    uint32_t hex_encode(const uint8_t* bytes, uint32_t length, char* out);
+    uint32_t hex_encode_spaced(const uint8_t* bytes, uint32_t length, char* out);
+    uint32_t hex_decode(const char* str, uint32_t length, uint8_t* bytes);
+
+}
+
+#endif //__HEXCODEC_H__